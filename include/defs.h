@@ -7,39 +7,150 @@
 #include <string>
 #include <memory>
 #include <sstream>
+#include <atomic>
+#include <chrono>
 
 #define NAMESPACE_TARO_WS_BEGIN namespace taro { namespace ws{
 #define NAMESPACE_TARO_WS_END } }
 #define USING_NAMESPACE_TARO_WS using namespace taro::ws;
 
-#define WS_FATAL taro::log::LogWriter( "co_ws", taro::log::eLogLevelFatal, __FILE__, __FUNCTION__, __LINE__ ).stream<std::stringstream>()
-#define WS_ERROR taro::log::LogWriter( "co_ws", taro::log::eLogLevelError, __FILE__, __FUNCTION__, __LINE__ ).stream<std::stringstream>()
-#define WS_WARN  taro::log::LogWriter( "co_ws", taro::log::eLogLevelWarn,  __FILE__, __FUNCTION__, __LINE__ ).stream<std::stringstream>()
-#define WS_TRACE taro::log::LogWriter( "co_ws", taro::log::eLogLevelTrace, __FILE__, __FUNCTION__, __LINE__ ).stream<std::stringstream>()
-#define WS_DEBUG taro::log::LogWriter( "co_ws", taro::log::eLogLevelDebug, __FILE__, __FUNCTION__, __LINE__ ).stream<std::stringstream>()
+// 日志级别, 与taro::log::ELogLevel的顺序一致, 数值越大越详细
+#define WS_LOG_LEVEL_FATAL 0
+#define WS_LOG_LEVEL_ERROR 1
+#define WS_LOG_LEVEL_WARN  2
+#define WS_LOG_LEVEL_TRACE 3
+#define WS_LOG_LEVEL_DEBUG 4
+
+// 编译期保留的最详细级别, 超过该级别的日志语句在编译期被移除, 例如 -DWS_LOG_LEVEL=2 只保留WARN及以上
+#ifndef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_DEBUG
+#endif
+
+// 运行时的默认级别, 更详细的日志需通过set_log_level开启, 热路径上的调试日志默认不构造输出
+#define WS_LOG_LEVEL_DEFAULT WS_LOG_LEVEL_WARN
+
+#define WS_LOG_FLOOD_MS 1000 // 连接级别的错误日志在同一位置的最小输出间隔(ms)
+
+#define WS_LOG_ON( lv ) ( ( lv ) <= WS_LOG_LEVEL && ( lv ) <= taro::ws::log_level() )
+#define WS_LOG_WRITER( level ) taro::log::LogWriter( "co_ws", level, __FILE__, __FUNCTION__, __LINE__ ).stream<std::stringstream>()
+
+// 级别关闭时整条语句被跳过, 包括 << 之后参数的求值
+#define WS_LOG( lv, level ) \
+    if ( !WS_LOG_ON( lv ) ) {} else WS_LOG_WRITER( level )
+
+// 限频输出, 同一位置在ms内最多输出一次, 下一次输出时附带期间被丢弃的条数
+#define WS_LOG_EVERY( lv, level, ms ) \
+    if ( !WS_LOG_ON( lv ) ) {} \
+    else if ( ![]() -> taro::ws::LogGate& { static taro::ws::LogGate gate; return gate; }().pass( ms ) ) {} \
+    else WS_LOG_WRITER( level ) << taro::ws::LogSkipped()
+
+#define WS_FATAL WS_LOG( WS_LOG_LEVEL_FATAL, taro::log::eLogLevelFatal )
+#define WS_ERROR WS_LOG( WS_LOG_LEVEL_ERROR, taro::log::eLogLevelError )
+#define WS_WARN  WS_LOG( WS_LOG_LEVEL_WARN,  taro::log::eLogLevelWarn )
+#define WS_DEBUG WS_LOG( WS_LOG_LEVEL_DEBUG, taro::log::eLogLevelDebug )
+#define WS_TRACE WS_LOG( WS_LOG_LEVEL_TRACE, taro::log::eLogLevelTrace )
+
+#define WS_ERROR_EVERY( ms ) WS_LOG_EVERY( WS_LOG_LEVEL_ERROR, taro::log::eLogLevelError, ms )
+#define WS_WARN_EVERY( ms )  WS_LOG_EVERY( WS_LOG_LEVEL_WARN,  taro::log::eLogLevelWarn,  ms )
+
+NAMESPACE_TARO_WS_BEGIN
+
+/**
+ * @brief 设置运行时日志级别, 不能超过编译期的WS_LOG_LEVEL, 默认为WS_LOG_LEVEL_DEFAULT
+ * 
+ * @param[in] level WS_LOG_LEVEL_*
+*/
+TARO_DLL_EXPORT void set_log_level( int32_t level );
+
+/**
+ * @brief 运行时日志级别
+*/
+TARO_DLL_EXPORT int32_t log_level();
+
+// 限频日志的闸门, 每个日志位置一个
+class LogGate
+{
+PUBLIC: // function
+
+    LogGate()
+        : next_ms_( 0 )
+        , skipped_( 0 )
+    {}
+
+    /**
+     * @brief 是否允许输出, 允许时将丢弃的条数记录到当前线程供LogSkipped输出
+    */
+    bool pass( uint32_t ms )
+    {
+        auto now  = ( uint64_t )std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+        auto next = next_ms_.load( std::memory_order_relaxed );
+        if ( now < next || !next_ms_.compare_exchange_strong( next, now + ms, std::memory_order_relaxed ) )
+        {
+            skipped_.fetch_add( 1, std::memory_order_relaxed );
+            return false;
+        }
+        last_skipped() = skipped_.exchange( 0, std::memory_order_relaxed );
+        return true;
+    }
+
+    static uint64_t& last_skipped()
+    {
+        static thread_local uint64_t skipped = 0;
+        return skipped;
+    }
+
+PRIVATE: // variable
+
+    std::atomic<uint64_t> next_ms_;
+    std::atomic<uint64_t> skipped_;
+};
+
+// 输出上一次限频期间丢弃的条数
+struct LogSkipped {};
+
+inline std::ostream& operator<<( std::ostream& os, LogSkipped const& )
+{
+    auto skipped = LogGate::last_skipped();
+    if ( skipped > 0 )
+    {
+        os << "[" << skipped << " suppressed] ";
+    }
+    return os;
+}
+
+NAMESPACE_TARO_WS_END
 
 NAMESPACE_TARO_BEGIN
 
 #define HTTP_VERSION "HTTP/1.1"
+#define HTTP_DECODE_MAX_BYTES ( 64ULL << 20 ) // 默认的解压后数据体上限
 
 enum EHttpRespCode
 {
+    eHttpRespCodeContinue    = 100,
     eHttpRespCodeOK          = 200,
     eHttpRespCodeRedirect    = 302,
     eHttpRespCodeBadReq      = 400,
     eHttpRespCodeUnauth      = 401,
     eHttpRespCodeForbidden   = 403,
     eHttpRespCodeNotFound    = 404,
+    eHttpRespCodeTooLarge    = 413,
+    eHttpRespCodeExpectFail  = 417,
+    eHttpRespCodeTooMany     = 429,
     eHttpRespCodeInterSvr    = 500,
     eHttpRespCodeSvrUnavail  = 503,
 };
 
+#define HTTP_MSG_CONTINUE     "Continue"
 #define HTTP_MSG_OK           "OK"
 #define HTTP_MSG_REDIR        "Moved Temporarily"
 #define HTTP_MSG_BADREQ       "Bad Request"
 #define HTTP_MSG_UNAUTH       "Unauthorized"
 #define HTTP_MSG_FORBINDDEN   "Forbidden"
 #define HTTP_MSG_NOTFOUND     "Not Found"
+#define HTTP_MSG_TOO_LARGE    "Payload Too Large"
+#define HTTP_MSG_EXPECT_FAIL  "Expectation Failed"
+#define HTTP_MSG_TOO_MANY     "Too Many Requests"
 #define HTTP_MSG_INTER_SVR    "Internal Server Error"
 #define HTTP_MSG_SVR_UNAVAIL  "Server Unavailable"
 
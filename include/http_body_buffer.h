@@ -0,0 +1,80 @@
+﻿
+#pragma once
+
+#include "defs.h"
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define HTTP_SPILL_BYTES ( 1ULL << 20 ) // 默认的内存缓存上限, 超过后写入临时文件
+
+struct HttpBodyBufferImpl;
+
+// 数据体缓存, 不超过上限时保存在内存中, 超过后转存到匿名临时文件, 内存占用固定
+class TARO_DLL_EXPORT HttpBodyBuffer
+{
+PUBLIC: // 公共函数
+
+    /**
+     * @brief 构造函数
+     *
+     * @param[in] spill_bytes 内存缓存上限
+     * @param[in] dir         临时文件目录 nullptr 表示系统临时目录
+    */
+    HttpBodyBuffer( uint64_t spill_bytes = HTTP_SPILL_BYTES, const char* dir = nullptr );
+
+    /**
+     * @brief 析构函数, 关闭并删除临时文件
+    */
+    ~HttpBodyBuffer();
+
+    /**
+     * @brief 追加数据
+     *
+     * @param[in] data  数据
+     * @param[in] bytes 数据大小
+     * @return TARO_OK 成功 TARO_ERR_FAILED 临时文件创建或写入失败
+    */
+    int32_t append( uint8_t const* data, uint32_t bytes );
+
+    /**
+     * @brief 将缓存的数据写入临时文件, 之后可以通过fd读取全部数据
+    */
+    int32_t flush();
+
+    /**
+     * @brief 数据总大小
+    */
+    uint64_t size() const;
+
+    /**
+     * @brief 是否已转存到临时文件
+    */
+    bool spilled() const;
+
+    /**
+     * @brief 内存中的数据, 已转存时返回nullptr
+    */
+    uint8_t const* data() const;
+
+    /**
+     * @brief 临时文件描述符, 未转存时返回-1, 读取时使用pread等不改变读写位置的方式
+    */
+    int32_t fd() const;
+
+    /**
+     * @brief 从指定位置读取数据, 不区分是否已转存
+     *
+     * @return 读取的大小 失败返回负数
+    */
+    int64_t read( uint64_t offset, uint8_t* buf, uint32_t bytes ) const;
+
+PRIVATE: // 私有函数
+
+    TARO_NO_COPY( HttpBodyBuffer );
+
+PRIVATE: // 私有变量
+
+    HttpBodyBufferImpl* impl_;
+};
+
+NAMESPACE_TARO_WS_END
@@ -4,6 +4,8 @@
 #include "http_proto.h"
 #include <net/tcp_client.h>
 #include <base/memory/dyn_packet.h>
+#include <vector>
+#include <functional>
 
 NAMESPACE_TARO_WS_BEGIN
 
@@ -14,6 +16,30 @@ struct HttpRespRet
     HttpResponseSPtr resp;
 };
 
+// 上传文件时数据体的封装方式
+enum EHttpBodyMode
+{
+    eHttpBodyLength,    // 原始数据, 请求头需要设置Content-Length
+    eHttpBodyChunk,     // chunk编码, 请求头需要设置Transfer-Encoding: chunked
+    eHttpBodyBoundary,  // 整个文件作为一个boundary part, 请求头需要设置相同的boundary
+};
+
+// 流水线请求
+struct HttpPipeReq
+{
+    HttpRequestSPtr req;
+    DynPacketSPtr   body;  // 数据体 可以为nullptr
+};
+
+/**
+ * @brief 回复数据体的接收函数, 数据到达后逐段调用
+ * 
+ * @param[in] data  数据
+ * @param[in] bytes 数据大小
+ * @return TARO_OK 继续接收 其余表示中止, 连接被关闭
+*/
+using HttpSinkFunc = std::function< int32_t( uint8_t const*, uint32_t ) >;
+
 struct HttpClientImpl;
 
 // http客户端
@@ -38,16 +64,28 @@ PUBLIC: // 公共函数
      * 
      * @param[in] ip
      * @param[in] port
+     * @param[in] ms   连接超时时间 0 表示一直阻塞
+     * @return TARO_OK 成功 TARO_ERR_TIMEOUT 超时 其余表示失败
     */
-    int32_t connect( const char* ip, uint16_t port );
+    int32_t connect( const char* ip, uint16_t port, uint32_t ms = 0 );
 
     /**
      * @brief 发送请求
      * 
      * @param[in] request http请求
-     * @param[in] body    http数据体
+     * @param[in] ms      发送超时时间 0 表示一直阻塞, 超时后连接被关闭且不可复用
+    */
+    int32_t send_req( HttpRequest const& request, uint32_t ms = 0 );
+
+    /**
+     * @brief 发送带Expect: 100-continue的请求头, 等待服务端确认后再发送数据体
+     *        服务端拒绝时数据体不必发送, 大文件上传只消耗一次往返
+     * 
+     * @param[in] request http请求
+     * @param[in] ms      等待100 Continue的时间, 超时后视为同意继续发送
+     * @return TARO_OK 可以发送数据体 TARO_ERR_FAILED 服务端已回复最终状态, 通过recv_resp获取, 不要发送数据体 其余表示失败
     */
-    int32_t send_req( HttpRequest const& request );
+    int32_t send_expect( HttpRequest const& request, uint32_t ms = 1000 );
 
     /**
      * @brief 发送回复
@@ -61,8 +99,9 @@ PUBLIC: // 公共函数
      * @brief 发送数据体
      * 
      * @param[in] body 数据体
+     * @param[in] ms   发送超时时间 0 表示一直阻塞, 超时后连接被关闭且不可复用
     */
-    int32_t send_body( DynPacketSPtr const& body );
+    int32_t send_body( DynPacketSPtr const& body, uint32_t ms = 0 );
 
     /**
      * @brief 发送chunk数据体
@@ -79,23 +118,97 @@ PUBLIC: // 公共函数
     */
     int32_t send_boundary_body( DynPacketSPtr const& body = nullptr, const char* boundary = nullptr );
 
+    /**
+     * @brief 从文件读取并发送数据体, 内存占用固定, 数据体的结束标识一并发送
+     * 
+     * @param[in] fd       文件描述符
+     * @param[in] offset   起始位置
+     * @param[in] bytes    数据大小
+     * @param[in] mode     封装方式
+     * @param[in] boundary boundary标识, 仅eHttpBodyBoundary时使用
+     * @return 失败时数据体可能已发出一部分, 连接应当关闭
+    */
+    int32_t send_file( int32_t fd, uint64_t offset, uint64_t bytes, EHttpBodyMode mode = eHttpBodyLength, const char* boundary = nullptr );
+
+    /**
+     * @brief 发送整个文件作为数据体
+     * 
+     * @param[in] path     文件路径
+     * @param[in] mode     封装方式
+     * @param[in] boundary boundary标识, 仅eHttpBodyBoundary时使用
+    */
+    int32_t send_file( const char* path, EHttpBodyMode mode = eHttpBodyLength, const char* boundary = nullptr );
+
     /**
      * @brief 发送请求并等待恢复
      * 
-     * @param[in] ms      超时时间 0 表示一直阻塞
-     * @return 回复信息
+     * @param[in] ms      接收本次回复的总超时时间 0 表示一直阻塞, 超时后连接被关闭且不可复用
+     * @return 回复信息, 超时返回TARO_ERR_TIMEOUT
     */
     HttpRespRet recv_resp( uint32_t ms = 0 );
 
+    /**
+     * @brief 接收回复, 数据体随到达逐段交给sink, 适用于大文件下载
+     *        chunk回复按到达的数据分段, boundary回复按part分段
+     * 
+     * @param[in] sink 数据体接收函数
+     * @param[in] ms   接收本次回复的总超时时间 0 表示一直阻塞
+     * @return 回复信息, body始终为nullptr
+    */
+    HttpRespRet recv_stream( HttpSinkFunc const& sink, uint32_t ms = 0 );
+
+    /**
+     * @brief 接收回复, 数据体写入文件
+     * 
+     * @param[in] fd 文件描述符, 从当前位置写入
+     * @param[in] ms 接收本次回复的总超时时间 0 表示一直阻塞
+    */
+    HttpRespRet recv_file( int32_t fd, uint32_t ms = 0 );
+
+    /**
+     * @brief 接收回复, 数据体写入调用方提供的缓冲
+     * 
+     * @param[in]     buffer 缓冲
+     * @param[in,out] bytes  输入缓冲大小 输出数据体大小, 超出缓冲大小时返回TARO_ERR_INVALID_ARG
+     * @param[in]     ms     接收本次回复的总超时时间 0 表示一直阻塞
+    */
+    HttpRespRet recv_buffer( uint8_t* buffer, uint64_t& bytes, uint32_t ms = 0 );
+
     /**
      * @brief 发送请求并等待恢复
      * 
      * @param[in] request http请求
-     * @param[in] ms      超时时间 0 表示一直阻塞
-     * @return 回复信息
+     * @param[in] ms      发送与接收的总超时时间 0 表示一直阻塞, 超时后连接被关闭且不可复用
+     * @return 回复信息, 超时返回TARO_ERR_TIMEOUT
     */
     HttpRespRet request( HttpRequest const& request, uint32_t ms = 0 );
 
+    /**
+     * @brief 流水线发送请求, 同一窗口内的请求合并为一次写入, 回复按发送顺序匹配
+     *        对端中途要求关闭连接时, 未得到回复的请求返回TARO_ERR_DISCONNECT, 由调用方决定是否重发
+     *
+     * @param[in] reqs   请求列表, 有数据体且未设置Content-Length的请求自动补充
+     * @param[in] window 未得到回复的最大请求数
+     * @param[in] ms     整个流水线的超时时间 0 表示一直阻塞
+     * @return 与请求一一对应的回复, chunk与boundary回复的数据体已合并
+    */
+    std::vector<HttpRespRet> pipeline( std::vector<HttpPipeReq> const& reqs, uint32_t window = 8, uint32_t ms = 0 );
+
+    /**
+     * @brief 设置回复的解压, 默认开启
+     *        Content-Encoding为gzip或deflate时数据体边接收边解压, 解压的回复去掉Content-Encoding与Content-Length,
+     *        回复头与交付的数据体一致
+     * 
+     * @param[in] enable    是否解压
+     * @param[in] max_bytes 解压后的数据体上限, 超过时返回TARO_ERR_INVALID_ARG, 用于防止压缩炸弹
+    */
+    void set_decode( bool enable, uint64_t max_bytes = HTTP_DECODE_MAX_BYTES );
+
+    /**
+     * @brief 连接是否空闲, 即已连接且上一个回复已完整读取, 空闲的连接才可以复用
+    */
+    bool idle() const;
+
 PRIVATE: // 私有类型
     
     friend struct HttpClientImpl;
@@ -0,0 +1,179 @@
+﻿
+#pragma once
+
+#include "http_client.h"
+#include <vector>
+#include <functional>
+
+NAMESPACE_TARO_WS_BEGIN
+
+struct HttpClientPoolImpl;
+
+// 连接池配置
+struct HttpPoolOpt
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpPoolOpt()
+        : min_idle( 0 )
+        , max_per_host( 8 )
+        , idle_timeout_ms( 60000 )
+        , check_idle_ms( 5000 )
+    {
+
+    }
+
+    uint32_t min_idle;        // 每个主机回收时保留的最少空闲连接数
+    uint32_t max_per_host;    // 每个主机的最大连接数(空闲与使用中之和)
+    uint32_t idle_timeout_ms; // 空闲超过该时间的连接在acquire/release时被回收
+    uint32_t check_idle_ms;   // 空闲超过该时间的连接在复用前做健康检查
+};
+
+// 对冲请求配置
+struct HttpHedgeOpt
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpHedgeOpt()
+        : percentile( 95 )
+        , init_delay_ms( 50 )
+        , max_attempts( 3 )
+        , budget_ratio( 0.1 )
+        , budget_burst( 10 )
+    {
+
+    }
+
+    uint32_t percentile;    // 以最近请求耗时的该百分位作为对冲延时
+    uint32_t init_delay_ms; // 耗时样本不足时的对冲延时
+    uint32_t max_attempts;  // 单个请求的最大尝试次数, 包括首次, 对冲与重试
+    double   budget_ratio;  // 每次成功的请求存入的重试令牌数
+    uint32_t budget_burst;  // 重试令牌上限, 对冲与重试均消耗一个令牌
+};
+
+// 批量请求中的单个请求
+struct HttpBatchReq
+{
+    std::string      host;
+    uint16_t         port;
+    net::SSLContext* ctx;   // 加密配置 可以为nullptr
+    HttpRequestSPtr  req;
+    DynPacketSPtr    body;  // 数据体 可以为nullptr
+};
+
+// 批量请求中单个请求的结果
+struct HttpBatchRet
+{
+    uint32_t    index;      // 请求在批量中的序号
+    HttpRespRet result;     // 回复, chunk与boundary回复的数据体已合并
+};
+
+// 批量请求配置
+struct HttpBatchOpt
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpBatchOpt()
+        : deadline_ms( 0 )
+        , wait_count( 0 )
+    {
+
+    }
+
+    uint32_t deadline_ms;   // 整批请求的截止时间 0 表示不限
+    uint32_t wait_count;    // 收到该数量的结果即返回 0 表示等待全部
+};
+
+/**
+ * @brief 批量请求结果回调, 每个请求完成时在调用scatter的协程中调用, scatter返回后不再调用
+*/
+using HttpBatchCallback = std::function< void( HttpBatchRet const& ) >;
+
+// http客户端连接池, 按(主机, 端口, 加密配置)复用长连接
+class TARO_DLL_EXPORT HttpClientPool
+{
+PUBLIC: // 公共函数
+
+    /**
+     * @brief 构造函数
+     *
+     * @param[in] opt 连接池配置
+    */
+    HttpClientPool( HttpPoolOpt const& opt = HttpPoolOpt() );
+
+    /**
+     * @brief 析构函数
+    */
+    ~HttpClientPool();
+
+    /**
+     * @brief 获取连接, 优先复用空闲连接, 连接数达到上限时在协程中等待
+     *
+     * @param[in] host 主机地址
+     * @param[in] port 端口
+     * @param[in] ctx  加密配置
+     * @param[in] ms   等待超时时间 0 表示一直等待
+     * @return 连接 失败返回nullptr
+    */
+    HttpClientSPtr acquire( const char* host, uint16_t port, net::SSLContext* ctx = nullptr, uint32_t ms = 0 );
+
+    /**
+     * @brief 归还连接, 只有回复已完整读取的连接才会被复用, 其余连接直接关闭
+     *
+     * @param[in] client 由acquire获取的连接
+    */
+    void release( HttpClientSPtr const& client );
+
+    /**
+     * @brief 立即回收空闲超时的连接, acquire与release已按HTTP_EVICT_INTERVAL的间隔自动回收,
+     *        连接池长时间不被使用时可以调用此接口释放连接
+     *
+     * @return 回收的连接数
+    */
+    uint32_t evict();
+
+    /**
+     * @brief 并发发送一批请求, 每个请求使用独立的连接, 总耗时取决于最慢的请求而非耗时之和
+     *        返回时仍在进行的请求继续在后台完成, 连接池需保证存活至其结束
+     *
+     * @param[in] reqs   请求列表
+     * @param[in] opt    批量配置
+     * @param[in] on_ret 每个请求完成时的回调 可以为nullptr
+     * @return 截止时间前完成的结果, 按完成顺序排列, 超时的请求不在其中
+     *         req为空的请求不发送, 结果为TARO_ERR_INVALID_ARG, 排在最前面
+    */
+    std::vector<HttpBatchRet> scatter( std::vector<HttpBatchReq> const& reqs, HttpBatchOpt const& opt = HttpBatchOpt(), HttpBatchCallback const& on_ret = nullptr );
+
+    /**
+     * @brief 设置对冲请求配置
+    */
+    void set_hedge( HttpHedgeOpt const& opt );
+
+    /**
+     * @brief 发送对冲请求, 超过对冲延时未收到回复时向下一个副本发送相同请求, 先到的回复生效, 其余请求被取消
+     *        失败时在重试令牌允许的情况下重试, 只有幂等方法(GET HEAD PUT DELETE OPTIONS TRACE)才会对冲与重试
+     *
+     * @param[in] replicas 同一请求的各个副本, 依次轮流使用, 只有一个时在同一主机的其他连接上对冲
+     * @param[in] ms       整个请求的超时时间 0 表示一直等待
+     * @return 回复信息, 超时返回TARO_ERR_TIMEOUT
+    */
+    HttpRespRet hedge( std::vector<HttpBatchReq> const& replicas, uint32_t ms = 0 );
+
+    /**
+     * @brief 获取空闲连接数
+    */
+    uint32_t idle_count() const;
+
+PRIVATE: // 私有函数
+
+    TARO_NO_COPY( HttpClientPool );
+
+PRIVATE: // 私有变量
+
+    HttpClientPoolImpl* impl_;
+};
+
+NAMESPACE_TARO_WS_END
@@ -3,6 +3,8 @@
 
 #include "defs.h"
 #include <base/memory/optional.h>
+#include <string>
+#include <vector>
 
 NAMESPACE_TARO_WS_BEGIN
 
@@ -67,6 +69,14 @@ PUBLIC: // 公共函数
     */
     bool contains( const char* key );
 
+    /**
+     * @brief 删除关键字
+     * 
+     * @param[in] key 关键字
+     * @return true 已删除 false 不存在
+    */
+    bool remove( const char* key );
+
     /**
      * @brief 设置时间
     */
@@ -226,6 +236,14 @@ PUBLIC: // 公共函数
     */
     bool contains( const char* key );
 
+    /**
+     * @brief 删除关键字
+     * 
+     * @param[in] key 关键字
+     * @return true 已删除 false 不存在
+    */
+    bool remove( const char* key );
+
     /**
      * @brief 设置时间
     */
@@ -324,4 +342,23 @@ PRIVATE: // 私有变量
 using HttpRequestSPtr  = std::shared_ptr< HttpRequest >;
 using HttpResponseSPtr = std::shared_ptr< HttpResponse >;
 
+// 回复压缩配置
+struct HttpCompressOpt
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpCompressOpt()
+        : min_bytes( 1024 )
+        , level( 6 )
+        , mime_types( { "text/", "application/json", "application/javascript", "application/x-javascript", "application/xml", "image/svg+xml" } )
+    {
+
+    }
+
+    uint32_t min_bytes;                   // Content-Length小于该值的回复不压缩, chunk回复总是压缩
+    int32_t  level;                       // 压缩等级 1-9
+    std::vector<std::string> mime_types;  // 需要压缩的Content-Type, 按前缀匹配
+};
+
 NAMESPACE_TARO_WS_END
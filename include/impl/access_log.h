@@ -0,0 +1,457 @@
+﻿
+#pragma once
+
+#include "web_server.h"
+#include "impl/file_io.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define ACCESS_URL_BYTES    192      // 记录中保留的url长度, 超过时截断
+#define ACCESS_PEER_BYTES   48
+#define ACCESS_METHOD_BYTES 8
+#define ACCESS_BATCH_BYTES  0x40000  // 后台线程单次写入的最大长度
+
+// 定长的访问记录, 在连接协程中填写, 由后台线程格式化
+struct AccessRecord
+{
+    uint64_t begin_ns;      // 请求开始时间(单调时钟)
+    uint64_t total_ns;      // 请求开始到结束的耗时
+    uint64_t handler_ns;    // 处理函数的耗时
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    int32_t  status;        // 0 表示未回复
+    uint32_t url_bytes;     // url的原始长度
+    char method[ACCESS_METHOD_BYTES];
+    char peer[ACCESS_PEER_BYTES];
+    char url[ACCESS_URL_BYTES];
+};
+
+// 单生产者单消费者的环形缓冲, 生产者为一个调度线程, 消费者为后台写入线程
+class AccessRing
+{
+PUBLIC: // function
+
+    explicit AccessRing( uint32_t records )
+        : head_( 0 )
+        , tail_( 0 )
+        , tail_cache_( 0 )
+    {
+        uint32_t capacity = 1;
+        while ( capacity < records )
+        {
+            capacity <<= 1;
+        }
+        mask_ = capacity - 1;
+        slots_.resize( capacity );
+    }
+
+    /**
+     * @brief 获取一个空闲记录, 写满时返回nullptr, 填写后调用commit
+    */
+    AccessRecord* claim()
+    {
+        uint64_t head = head_.load( std::memory_order_relaxed );
+        if ( head - tail_cache_ > mask_ )
+        {
+            tail_cache_ = tail_.load( std::memory_order_acquire );
+            if ( head - tail_cache_ > mask_ )
+            {
+                return nullptr;
+            }
+        }
+        return &slots_[head & mask_];
+    }
+
+    void commit()
+    {
+        head_.store( head_.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+
+    /**
+     * @brief 取出所有已提交的记录, 只由消费者调用
+    */
+    template<typename F>
+    void drain( F const& fn )
+    {
+        uint64_t tail = tail_.load( std::memory_order_relaxed );
+        uint64_t head = head_.load( std::memory_order_acquire );
+        for ( ; tail != head; ++tail )
+        {
+            fn( slots_[tail & mask_] );
+        }
+        tail_.store( tail, std::memory_order_release );
+    }
+
+PRIVATE: // variable
+
+    std::atomic<uint64_t> head_;    // 生产者写
+    char pad0_[64];
+    std::atomic<uint64_t> tail_;    // 消费者写
+    char pad1_[64];
+    uint64_t tail_cache_;           // 生产者缓存的tail, 减少跨线程读取
+    uint64_t mask_;
+    std::vector<AccessRecord> slots_;
+};
+
+// 异步访问日志, 每个调度线程一个环形缓冲, 后台线程批量格式化为JSON行后写入并按大小轮转
+// 缓冲写满时丢弃记录并计数, 不阻塞连接协程
+class AccessLog
+{
+PUBLIC: // function
+
+    explicit AccessLog( HttpAccessLogOpt const& opt )
+        : opt_( opt )
+        , id_( next_id()++ )
+        , fd_( -1 )
+        , file_bytes_( 0 )
+        , stop_( false )
+        , dropped_( 0 )
+    {
+        steady_base_ns_ = ( uint64_t )std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+        wall_base_ms_   = ( uint64_t )std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+    }
+
+    ~AccessLog()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if ( thread_.joinable() )
+        {
+            thread_.join();
+        }
+
+        if ( fd_ >= 0 )
+        {
+            close_fd( fd_ );
+        }
+    }
+
+    /**
+     * @brief 打开日志文件并启动后台线程
+    */
+    bool start()
+    {
+        fd_ = open_append( opt_.path.c_str(), file_bytes_ );
+        if ( fd_ < 0 )
+        {
+            WS_ERROR << "open access log failed:" << opt_.path;
+            return false;
+        }
+        thread_ = std::thread( &AccessLog::run, this );
+        return true;
+    }
+
+    /**
+     * @brief 获取当前线程的空闲记录, 缓冲写满时计数并返回nullptr
+    */
+    AccessRecord* claim()
+    {
+        auto rec = ring()->claim();
+        if ( rec == nullptr )
+        {
+            dropped_.fetch_add( 1, std::memory_order_relaxed );
+        }
+        return rec;
+    }
+
+    /**
+     * @brief 提交当前线程刚填写的记录
+    */
+    void commit()
+    {
+        ring()->commit();
+    }
+
+    /**
+     * @brief 因缓冲写满丢弃的记录数
+    */
+    uint64_t dropped() const
+    {
+        return dropped_.load( std::memory_order_relaxed );
+    }
+
+PRIVATE: // type
+
+    struct Cache
+    {
+        uint64_t id;
+        AccessRing* ring;
+    };
+
+PRIVATE: // function
+
+    static std::atomic<uint64_t>& next_id()
+    {
+        static std::atomic<uint64_t> id( 1 );
+        return id;
+    }
+
+    /**
+     * @brief 当前线程的缓冲, 线程首次写入时创建
+    */
+    AccessRing* ring()
+    {
+        static thread_local Cache cache = { 0, nullptr };
+        if ( cache.id == id_ )
+        {
+            return cache.ring;
+        }
+
+        std::lock_guard<std::mutex> lock( mutex_ );
+        auto it = owners_.find( std::this_thread::get_id() );
+        if ( it == owners_.end() )
+        {
+            rings_.emplace_back( new AccessRing( opt_.ring_records ) );
+            it = owners_.emplace( std::this_thread::get_id(), rings_.back().get() ).first;
+        }
+        cache.id   = id_;
+        cache.ring = it->second;
+        return cache.ring;
+    }
+
+    void run()
+    {
+        // 开启轮转时单次写入不超过文件上限, 避免一次写入使文件远超上限
+        size_t batch_bytes = ( opt_.max_bytes > 0 ) ? ( size_t )std::min<uint64_t>( opt_.max_bytes, ACCESS_BATCH_BYTES ) : ACCESS_BATCH_BYTES;
+        std::string buf;
+        buf.reserve( batch_bytes + 1024 );
+        while ( 1 )
+        {
+            bool stop = false;
+            {
+                std::unique_lock<std::mutex> lock( mutex_ );
+                cv_.wait_for( lock, std::chrono::milliseconds( opt_.flush_ms ), [this]()
+                {
+                    return stop_;
+                } );
+                stop = stop_;
+            }
+
+            for ( size_t i = 0; i < ring_count(); ++i )
+            {
+                ring_at( i )->drain( [&]( AccessRecord const& rec )
+                {
+                    format( rec, buf );
+                    if ( buf.size() >= batch_bytes )
+                    {
+                        flush( buf );
+                    }
+                } );
+            }
+            flush( buf );
+
+            if ( stop )
+            {
+                return;
+            }
+        }
+    }
+
+    size_t ring_count()
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return rings_.size();
+    }
+
+    AccessRing* ring_at( size_t index )
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        return rings_[index].get();
+    }
+
+    /**
+     * @brief 写入文件, 超过大小上限时先轮转
+    */
+    void flush( std::string& buf )
+    {
+        if ( buf.empty() )
+        {
+            return;
+        }
+
+        if ( fd_ < 0 )
+        {
+            fd_ = open_append( opt_.path.c_str(), file_bytes_ ); // 轮转后重新打开失败时重试
+        }
+
+        if ( opt_.max_bytes > 0 && file_bytes_ > 0 && file_bytes_ + buf.size() > opt_.max_bytes )
+        {
+            rotate();
+        }
+
+        if ( fd_ >= 0 && write_all( fd_, ( uint8_t const* )buf.data(), buf.size() ) )
+        {
+            file_bytes_ += buf.size();
+        }
+        buf.clear();
+    }
+
+    /**
+     * @brief 轮转 path -> path.1 -> path.2 ..., 超过max_files的文件被覆盖
+    */
+    void rotate()
+    {
+        close_fd( fd_ );
+        fd_ = -1;
+        if ( opt_.max_files == 0 )
+        {
+            std::remove( opt_.path.c_str() );
+        }
+        else
+        {
+            for ( uint32_t i = opt_.max_files; i > 1; --i )
+            {
+                auto from = opt_.path + "." + std::to_string( i - 1 );
+                auto to   = opt_.path + "." + std::to_string( i );
+                std::remove( to.c_str() );
+                std::rename( from.c_str(), to.c_str() );
+            }
+            auto first = opt_.path + ".1";
+            std::remove( first.c_str() );
+            std::rename( opt_.path.c_str(), first.c_str() );
+        }
+
+        fd_ = open_append( opt_.path.c_str(), file_bytes_ );
+        if ( fd_ < 0 )
+        {
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "reopen access log failed:" << opt_.path;
+        }
+    }
+
+    /**
+     * @brief 格式化为一行JSON
+    */
+    void format( AccessRecord const& rec, std::string& out )
+    {
+        uint64_t wall_ms = wall_base_ms_ + ( int64_t )( rec.begin_ns - steady_base_ns_ ) / 1000000;
+        time_t secs = ( time_t )( wall_ms / 1000 );
+        tm utc;
+#if defined( _WIN32 ) || defined( _WIN64 )
+        gmtime_s( &utc, &secs );
+#else
+        gmtime_r( &secs, &utc );
+#endif
+        char time_str[32];
+        auto len = strftime( time_str, sizeof( time_str ), "%Y-%m-%dT%H:%M:%S", &utc );
+        snprintf( time_str + len, sizeof( time_str ) - len, ".%03uZ", ( uint32_t )( wall_ms % 1000 ) );
+
+        out.append( "{\"time\":\"" ).append( time_str );
+        out.append( "\",\"peer\":\"" );
+        escape( rec.peer, strnlen( rec.peer, ACCESS_PEER_BYTES ), out );
+        out.append( "\",\"method\":\"" );
+        escape( rec.method, strnlen( rec.method, ACCESS_METHOD_BYTES ), out );
+        out.append( "\",\"url\":\"" );
+        escape( rec.url, std::min<uint32_t>( rec.url_bytes, ACCESS_URL_BYTES ), out );
+        out.append( "\",\"status\":" ).append( std::to_string( rec.status ) );
+        out.append( ",\"bytes_in\":" ).append( std::to_string( rec.bytes_in ) );
+        out.append( ",\"bytes_out\":" ).append( std::to_string( rec.bytes_out ) );
+        out.append( ",\"duration_us\":" ).append( std::to_string( rec.total_ns / 1000 ) );
+        out.append( ",\"handler_us\":" ).append( std::to_string( rec.handler_ns / 1000 ) );
+        if ( rec.url_bytes > ACCESS_URL_BYTES )
+        {
+            out.append( ",\"url_bytes\":" ).append( std::to_string( rec.url_bytes ) );
+        }
+        out.append( "}\n" );
+    }
+
+    /**
+     * @brief 转义为JSON字符串, 合法的UTF-8字符原样输出, 其余字节(包括url截断产生的不完整字符)输出为\u00XX,
+     *        保证每一行都是合法的JSON
+    */
+    static void escape( const char* data, size_t bytes, std::string& out )
+    {
+        for ( size_t i = 0; i < bytes; ++i )
+        {
+            auto c = ( uint8_t )data[i];
+            size_t len = ( c >= 0x80 ) ? utf8_char( ( uint8_t const* )data + i, bytes - i ) : 1;
+            if ( c == '"' || c == '\\' )
+            {
+                out.push_back( '\\' );
+                out.push_back( ( char )c );
+            }
+            else if ( c < 0x20 || len == 0 )
+            {
+                char hex[8];
+                snprintf( hex, sizeof( hex ), "\\u%04x", c );
+                out.append( hex );
+            }
+            else
+            {
+                out.append( data + i, len );
+                i += len - 1;
+            }
+        }
+    }
+
+    /**
+     * @brief data开头的UTF-8字符的字节数, 不合法或不完整时返回0
+    */
+    static size_t utf8_char( uint8_t const* data, size_t bytes )
+    {
+        uint8_t c  = data[0];
+        uint8_t lo = 0x80; // 第二个字节的范围, 排除超长编码 代理区与超过U+10FFFF的码点
+        uint8_t hi = 0xBF;
+        size_t len = 0;
+        if ( c >= 0xC2 && c <= 0xDF )
+        {
+            len = 2;
+        }
+        else if ( c >= 0xE0 && c <= 0xEF )
+        {
+            len = 3;
+            lo  = ( c == 0xE0 ) ? 0xA0 : 0x80;
+            hi  = ( c == 0xED ) ? 0x9F : 0xBF;
+        }
+        else if ( c >= 0xF0 && c <= 0xF4 )
+        {
+            len = 4;
+            lo  = ( c == 0xF0 ) ? 0x90 : 0x80;
+            hi  = ( c == 0xF4 ) ? 0x8F : 0xBF;
+        }
+
+        if ( len == 0 || bytes < len || data[1] < lo || data[1] > hi )
+        {
+            return 0;
+        }
+
+        for ( size_t i = 2; i < len; ++i )
+        {
+            if ( ( data[i] & 0xC0 ) != 0x80 )
+            {
+                return 0;
+            }
+        }
+        return len;
+    }
+
+PRIVATE: // variable
+
+    HttpAccessLogOpt opt_;
+    uint64_t id_;               // 区分不同实例的线程缓存
+    int32_t fd_;
+    uint64_t file_bytes_;
+    uint64_t steady_base_ns_;   // 单调时钟与系统时间的对应关系, 用于换算记录的时间
+    uint64_t wall_base_ms_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+    std::thread thread_;
+    std::vector<std::unique_ptr<AccessRing>> rings_;
+    std::map<std::thread::id, AccessRing*> owners_;
+    std::atomic<uint64_t> dropped_;
+};
+
+NAMESPACE_TARO_WS_END
@@ -0,0 +1,88 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <co_routine/inc.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define CO_EVENT_MIN_STEP 1 // 等待间隔的初值(ms)
+#define CO_EVENT_MAX_STEP 8 // 等待间隔的上限(ms)
+
+// 协程间的事件通知, 通知方可以是任意线程或协程, 通知时代数加一
+// 运行时只提供定时挂起(rt::co_wait), 等待方挂起后按指数退避的间隔检查代数,
+// 短暂的等待在1ms内恢复, 长时间的等待唤醒次数按对数增长而不是每毫秒一次,
+// 对恢复延迟敏感的等待可以把间隔上限设为CO_EVENT_MIN_STEP
+class CoEvent
+{
+PUBLIC: // function
+
+    CoEvent()
+        : gen_( 0 )
+    {
+
+    }
+
+    /**
+     * @brief 当前代数, 检查等待条件之前读取, 之后的通知都会使代数变化
+    */
+    uint64_t generation() const
+    {
+        return gen_.load( std::memory_order_acquire );
+    }
+
+    /**
+     * @brief 通知所有等待方
+    */
+    void notify()
+    {
+        gen_.fetch_add( 1, std::memory_order_acq_rel );
+    }
+
+    /**
+     * @brief 挂起当前协程直到代数不再是seen
+     *
+     * @param[in] seen 检查等待条件之前读取的代数
+     * @param[in] ms   最长等待时间 0 表示不限
+     * @param[in] max_step 等待间隔的上限, 即收到通知后最多延迟恢复的时间
+     * @return true 收到通知 false 超时
+    */
+    bool wait( uint64_t seen, uint32_t ms = 0, uint32_t max_step = CO_EVENT_MAX_STEP ) const
+    {
+        uint64_t begin = now_ms();
+        uint32_t step  = CO_EVENT_MIN_STEP;
+        max_step = std::max<uint32_t>( max_step, CO_EVENT_MIN_STEP );
+        while ( generation() == seen )
+        {
+            uint32_t wait = step;
+            if ( ms > 0 )
+            {
+                uint64_t spent = now_ms() - begin;
+                if ( spent >= ms )
+                {
+                    return false;
+                }
+                wait = ( uint32_t )std::min<uint64_t>( step, ms - spent );
+            }
+            rt::co_wait( wait );
+            step = std::min<uint32_t>( step * 2, max_step );
+        }
+        return true;
+    }
+
+PRIVATE: // function
+
+    static uint64_t now_ms()
+    {
+        return ( uint64_t )std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+PRIVATE: // variable
+
+    std::atomic<uint64_t> gen_;
+};
+
+NAMESPACE_TARO_WS_END
@@ -0,0 +1,137 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include "impl/co_event.h"
+#include <net/tcp_client.h>
+#include <co_routine/inc.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+NAMESPACE_TARO_WS_BEGIN
+
+// 绝对截止时间, 覆盖整个操作而非单次收发, 慢速对端无法通过逐字节发送拉长总耗时
+// 使用单调时钟, 系统时间被调整时截止时间不会提前或推迟
+class Deadline
+{
+PUBLIC: // function
+
+    /**
+     * @brief 构造函数
+     * 
+     * @param[in] ms 从现在起的时长 0 表示不限
+    */
+    explicit Deadline( uint32_t ms = 0 )
+        : at_( ( ms == 0 ) ? 0 : now_ms() + ms )
+    {
+
+    }
+
+    /**
+     * @brief 是否不限时
+    */
+    bool infinite() const
+    {
+        return at_ == 0;
+    }
+
+    /**
+     * @brief 是否已到期
+    */
+    bool expired() const
+    {
+        return at_ != 0 && now_ms() >= at_;
+    }
+
+    /**
+     * @brief 剩余时间, 作为单次收发的超时参数
+     * 
+     * @return 0 表示不限 已到期时返回1, 使下层立即超时而不是一直阻塞
+    */
+    uint32_t remain() const
+    {
+        if ( at_ == 0 )
+        {
+            return 0;
+        }
+        uint64_t now = now_ms();
+        return ( now >= at_ ) ? 1 : ( uint32_t )std::min<uint64_t>( at_ - now, UINT32_MAX );
+    }
+
+    /**
+     * @brief 取本截止时间与从现在起ms之后两者中较早的一个
+     *
+     * @param[in] ms 0 表示不限, 直接返回本截止时间
+    */
+    Deadline sooner( uint32_t ms ) const
+    {
+        if ( ms == 0 )
+        {
+            return *this;
+        }
+        Deadline other( ms );
+        return ( at_ != 0 && at_ <= other.at_ ) ? *this : other;
+    }
+
+PRIVATE: // function
+
+    static uint64_t now_ms()
+    {
+        return ( uint64_t )std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+PRIVATE: // variable
+
+    uint64_t at_;
+};
+
+// 异步连接的结果, 连接协程完成时通知等待方
+struct ConnectState
+{
+    ConnectState()
+        : ret( TARO_ERR_CONTINUE )
+    {}
+
+    std::atomic<int32_t> ret;
+    CoEvent event;
+};
+
+/**
+ * @brief 在截止时间内建立连接, 连接在独立的协程中进行, 到期后关闭连接以取消
+ * 
+ * @return TARO_OK 成功 TARO_ERR_TIMEOUT 超时 TARO_ERR_FAILED 失败
+*/
+inline int32_t connect_until( net::TcpClientSPtr const& cli, const char* ip, uint16_t port, Deadline const& dl )
+{
+    if ( dl.infinite() )
+    {
+        return cli->connect( ip, port ) ? TARO_OK : TARO_ERR_FAILED;
+    }
+
+    auto state = std::make_shared<ConnectState>();
+    std::string host( ip );
+    co_run [cli, host, port, state]()
+    {
+        state->ret.store( cli->connect( host.c_str(), port ) ? TARO_OK : TARO_ERR_FAILED );
+        state->event.notify();
+    }, opt_name( "connect" );
+
+    while ( 1 )
+    {
+        auto seen = state->event.generation();
+        if ( state->ret.load() != TARO_ERR_CONTINUE )
+        {
+            return state->ret.load();
+        }
+
+        if ( dl.expired() )
+        {
+            cli->close();
+            return TARO_ERR_TIMEOUT;
+        }
+        state->event.wait( seen, dl.remain() );
+    }
+}
+
+NAMESPACE_TARO_WS_END
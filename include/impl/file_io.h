@@ -0,0 +1,180 @@
+﻿
+#pragma once
+
+#include "defs.h"
+
+#if defined( _WIN32 ) || defined( _WIN64 )
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+#include <cstdlib>
+#include <algorithm>
+
+NAMESPACE_TARO_WS_BEGIN
+
+/**
+* @brief 从文件指定位置读取数据, 不改变文件的读写位置(windows除外)
+*/
+inline int64_t read_at( int32_t fd, uint8_t* buf, uint32_t bytes, uint64_t offset )
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+    if ( _lseeki64( fd, ( __int64 )offset, SEEK_SET ) < 0 )
+    {
+        return -1;
+    }
+    return _read( fd, buf, bytes );
+#else
+    return ::pread( fd, buf, bytes, ( off_t )offset );
+#endif
+}
+
+/**
+* @brief 写入文件
+*/
+inline int64_t write_fd( int32_t fd, uint8_t const* buf, uint32_t bytes )
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+    return _write( fd, buf, bytes );
+#else
+    return ::write( fd, buf, bytes );
+#endif
+}
+
+/**
+* @brief 以只读方式打开文件
+* 
+* @param[out] bytes 文件大小
+* @return 文件描述符 失败返回-1
+*/
+inline int32_t open_read( const char* path, uint64_t& bytes )
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+    int32_t fd = _open( path, _O_RDONLY | _O_BINARY );
+    struct _stat64 st;
+    if ( fd >= 0 && _fstat64( fd, &st ) != 0 )
+    {
+        _close( fd );
+        return -1;
+    }
+#else
+    int32_t fd = ::open( path, O_RDONLY | O_CLOEXEC );
+    struct stat st;
+    if ( fd >= 0 && ::fstat( fd, &st ) != 0 )
+    {
+        ::close( fd );
+        return -1;
+    }
+#endif
+    if ( fd >= 0 )
+    {
+        bytes = ( uint64_t )st.st_size;
+    }
+    return fd;
+}
+
+/**
+* @brief 以追加方式打开文件, 不存在时创建
+* 
+* @param[out] bytes 文件当前大小
+* @return 文件描述符 失败返回-1
+*/
+inline int32_t open_append( const char* path, uint64_t& bytes )
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+    int32_t fd = _open( path, _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE );
+    struct _stat64 st;
+    if ( fd >= 0 && _fstat64( fd, &st ) != 0 )
+    {
+        _close( fd );
+        return -1;
+    }
+#else
+    int32_t fd = ::open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    struct stat st;
+    if ( fd >= 0 && ::fstat( fd, &st ) != 0 )
+    {
+        ::close( fd );
+        return -1;
+    }
+#endif
+    if ( fd >= 0 )
+    {
+        bytes = ( uint64_t )st.st_size;
+    }
+    return fd;
+}
+
+/**
+* @brief 在目录下创建匿名临时文件, 关闭后自动删除
+* 
+* @return 文件描述符 失败返回-1
+*/
+inline int32_t open_temp( const char* dir )
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+    char* name = _tempnam( dir, "taro" );
+    if ( name == nullptr )
+    {
+        return -1;
+    }
+    int32_t fd = _open( name, _O_CREAT | _O_EXCL | _O_RDWR | _O_BINARY | _O_TEMPORARY, _S_IREAD | _S_IWRITE );
+    free( name );
+    return fd;
+#else
+#if defined( O_TMPFILE )
+    int32_t fd = ::open( dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600 );
+    if ( fd >= 0 )
+    {
+        return fd;
+    }
+#endif
+    // 文件系统不支持O_TMPFILE时创建后立即删除
+    std::string path = std::string( dir ) + "/taro_body_XXXXXX";
+    int32_t tmp = ::mkstemp( &path[0] );
+    if ( tmp >= 0 )
+    {
+        ::unlink( path.c_str() );
+        ::fcntl( tmp, F_SETFD, FD_CLOEXEC );
+    }
+    return tmp;
+#endif
+}
+
+/**
+* @brief 写入全部数据, 处理部分写入
+* 
+* @return 成功返回true
+*/
+inline bool write_all( int32_t fd, uint8_t const* buf, uint64_t bytes )
+{
+    while ( bytes > 0 )
+    {
+        auto len = write_fd( fd, buf, ( uint32_t )std::min<uint64_t>( bytes, 0x40000000 ) );
+        if ( len <= 0 )
+        {
+            return false;
+        }
+        buf   += len;
+        bytes -= ( uint64_t )len;
+    }
+    return true;
+}
+
+/**
+* @brief 关闭文件
+*/
+inline void close_fd( int32_t fd )
+{
+#if defined( _WIN32 ) || defined( _WIN64 )
+    _close( fd );
+#else
+    ::close( fd );
+#endif
+}
+
+NAMESPACE_TARO_WS_END
@@ -1,9 +1,11 @@
-
+﻿
 #pragma once
 
 #include "impl/http_proto_impl.h"
 #include "impl/web_server_impl.h"
+#include "impl/http_deflater.h"
 #include <map>
+#include <vector>
 #include <fstream>
 #include <base/utils/string_tool.h>
 
@@ -55,7 +57,32 @@ PUBLIC: // function
         }
         file_path += url;
 
-        std::ifstream is( file_path, std::ios::binary );
+        // 存在预压缩的同名文件且请求方接受该编码时直接发送压缩文件
+        std::string encoding;
+        bool vary = false;
+        auto accept = req->get<std::string>( "Accept-Encoding" );
+        std::ifstream is;
+        for ( auto const& one : precompressed_ )
+        {
+            std::ifstream sibling( file_path + one.second, std::ios::binary );
+            if ( !sibling )
+            {
+                continue;
+            }
+
+            vary = true;
+            if ( encoding.empty() && accept.valid() && HttpDeflater::accepts( accept.value(), one.first.c_str() ) )
+            {
+                encoding = one.first;
+                is = std::move( sibling );
+            }
+        }
+
+        if ( encoding.empty() )
+        {
+            is.open( file_path, std::ios::binary );
+        }
+
         if ( !is )
         {
             notfound_repsonse( conn );
@@ -80,6 +107,14 @@ PUBLIC: // function
         resp.set( "Server", "Taro Http Server 0.1" );
         resp.set( "Content-Type", get_file_type( file_path ) );
         resp.set( "Content-Length", content->size() );
+        if ( !encoding.empty() )
+        {
+            resp.set( "Content-Encoding", encoding );
+        }
+        if ( vary )
+        {
+            resp.set( "Vary", "Accept-Encoding" );
+        }
         resp.set_time();
         conn->send_resp( resp );
         conn->send_body( content );
@@ -111,6 +146,10 @@ PRIVATE: // function
         file_type_["jpeg"] = "image/jpeg";
         file_type_["jpg"]  = "application/x-jpg";
         file_type_["png"]  = "image/png";
+
+        // 按优先级排列
+        precompressed_.emplace_back( "br",   ".br" );
+        precompressed_.emplace_back( "gzip", ".gz" );
     }
 
     void notfound_repsonse( HttpClientSPtr conn )
@@ -132,6 +171,7 @@ PRIVATE: // variable
     std::string index_;
     std::string root_;
     std::map<std::string, std::string> file_type_;
+    std::vector<std::pair<std::string, std::string>> precompressed_; // 编码与文件后缀
 };
 
 NAMESPACE_TARO_WS_END
@@ -0,0 +1,181 @@
+﻿
+#pragma once
+
+#include "web_server.h"
+#include "impl/http_proto_impl.h"
+#include <atomic>
+#include <algorithm>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define HTTP_ADMIT_PROBE_MS 5 // 调度延时探测的间隔(ms)
+
+// 准入控制, 限制连接数与请求数, 并按调度排队延时丢弃请求
+// 排队延时由探测协程测量: 协程等待HTTP_ADMIT_PROBE_MS后实际被唤醒的延迟即就绪协程排队等待调度线程的时间
+class HttpAdmission
+{
+PUBLIC: // function
+
+    HttpAdmission()
+        : conns_( 0 )
+        , inflight_( 0 )
+        , overloaded_( false )
+        , last_delay_( 0 )
+        , window_min_( UINT32_MAX )
+        , window_begin_( 0 )
+        , shed_( 0 )
+    {
+        set( HttpAdmitOpt() );
+    }
+
+    /**
+     * @brief 设置配置并生成503回复
+    */
+    void set( HttpAdmitOpt const& opt )
+    {
+        opt_ = opt;
+        std::stringstream ss;
+        ss << HTTP_VERSION << " " << eHttpRespCodeSvrUnavail << " " << HTTP_MSG_SVR_UNAVAIL << HTTP_SEP
+           << "Retry-After: " << opt.retry_after_s << HTTP_SEP
+           << "Content-Length: 0" << HTTP_SEP
+           << "Connection: close" << HTTP_SEP << HTTP_SEP;
+        reject_ = ss.str();
+    }
+
+    HttpAdmitOpt const& opt() const
+    {
+        return opt_;
+    }
+
+    /**
+     * @brief 预先生成的503回复
+    */
+    std::string const& reject() const
+    {
+        return reject_;
+    }
+
+    /**
+     * @brief 新连接准入
+    */
+    bool enter_conn()
+    {
+        if ( opt_.max_conns > 0 && conns_.fetch_add( 1 ) >= opt_.max_conns )
+        {
+            --conns_;
+            ++shed_;
+            return false;
+        }
+        if ( opt_.max_conns == 0 )
+        {
+            ++conns_;
+        }
+        return true;
+    }
+
+    void leave_conn()
+    {
+        --conns_;
+    }
+
+    /**
+     * @brief 请求准入, 依次检查排队延时, 全局请求数与路径请求数
+     *
+     * @param[in] route     路径的请求计数
+     * @param[in] route_max 路径的请求数上限 0 表示不限
+    */
+    bool enter( std::atomic<uint32_t>& route, uint32_t route_max )
+    {
+        // 持续过载时只丢弃当前排队延时仍超过目标值的请求
+        if ( overloaded_ && last_delay_ > opt_.target_delay_ms )
+        {
+            ++shed_;
+            return false;
+        }
+
+        if ( opt_.max_inflight > 0 && inflight_.fetch_add( 1 ) >= opt_.max_inflight )
+        {
+            --inflight_;
+            ++shed_;
+            return false;
+        }
+        if ( opt_.max_inflight == 0 )
+        {
+            ++inflight_;
+        }
+
+        if ( route_max > 0 && route.fetch_add( 1 ) >= route_max )
+        {
+            --route;
+            --inflight_;
+            ++shed_;
+            return false;
+        }
+        if ( route_max == 0 )
+        {
+            ++route;
+        }
+        return true;
+    }
+
+    void leave( std::atomic<uint32_t>& route )
+    {
+        --route;
+        --inflight_;
+    }
+
+    /**
+     * @brief 记录一次调度延时, 只由探测协程调用
+     *        观测周期内的最小延时超过目标值表示存在持续排队而非短时突发
+    */
+    void on_delay( uint32_t delay, uint64_t now )
+    {
+        last_delay_ = delay;
+        window_min_ = std::min( window_min_, delay );
+        if ( now - window_begin_ < opt_.interval_ms )
+        {
+            return;
+        }
+
+        bool overloaded = ( window_min_ > opt_.target_delay_ms );
+        if ( overloaded != overloaded_ )
+        {
+            WS_WARN << ( overloaded ? "overload detected" : "overload cleared" ) << " min delay:" << window_min_ << "ms";
+        }
+        overloaded_   = overloaded;
+        window_min_   = UINT32_MAX;
+        window_begin_ = now;
+    }
+
+    uint32_t conns() const
+    {
+        return conns_;
+    }
+
+    uint32_t inflight() const
+    {
+        return inflight_;
+    }
+
+    /**
+     * @brief 被拒绝的连接与请求总数
+    */
+    uint64_t shed() const
+    {
+        return shed_;
+    }
+
+PRIVATE: // variable
+
+    HttpAdmitOpt opt_;
+    std::string reject_;
+    std::atomic<uint32_t> conns_;
+    std::atomic<uint32_t> inflight_;
+    std::atomic<bool> overloaded_;
+    std::atomic<uint32_t> last_delay_;
+    uint32_t window_min_;   // 当前周期内的最小延时
+    uint64_t window_begin_; // 当前周期的开始时间
+    std::atomic<uint64_t> shed_;
+};
+
+NAMESPACE_TARO_WS_END
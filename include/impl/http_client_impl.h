@@ -3,10 +3,21 @@
 
 #include "http_client.h"
 #include "impl/http_proto_impl.h"
+#include "impl/deadline.h"
+#include "impl/http_inflater.h"
+#include "impl/http_deflater.h"
+#include "impl/http_metrics.h"
+#include "impl/tracer.h"
 #include <net/tcp_client.h>
+#include <condition_variable>
+#include <list>
+#include <mutex>
 
 NAMESPACE_TARO_WS_BEGIN
 
+#define HTTP_COALESCE_BYTES  4096     // 不超过该大小的数据与帧头合并发送
+#define HTTP_STAGE_MAX_BYTES 0x100000 // 暂存的回复达到该大小时, 工作线程等待连接协程发出后再继续写入
+
 // HTTP客户端内部实现
 struct HttpClientImpl
 {
@@ -15,26 +26,413 @@ struct HttpClientImpl
     */
     HttpClientImpl( bool active = true )
         : active_( active )
+        , keep_alive_( true )
+        , decode_( true )
+        , inflating_( false )
+        , decode_limit_( HTTP_DECODE_MAX_BYTES )
+        , compress_opt_( nullptr )
+        , accept_enc_( eHttpEncodingIdentity )
+        , deflating_( false )
+        , deflate_chunked_( false )
+        , deflate_remain_( 0 )
+        , staging_( false )
+        , stage_failed_( false )
+        , stage_event_( nullptr )
+        , metrics_( nullptr )
+        , resp_code_( 0 )
+        , sent_bytes_( 0 )
+        , conn_id_( 0 )
+    {
+
+    }
+
+    /**
+     * @brief 发送数据, 暂存模式下写入内存
+     *
+     * @param[in] ms 发送超时时间 0 表示一直阻塞, 发送失败时数据可能已部分写入, 连接不可复用, 限时发送的连接同时被关闭
+    */
+    int32_t write( char* data, uint32_t bytes, uint32_t ms = 0 )
+    {
+        if ( metrics_ != nullptr )
+        {
+            metrics_->add( HttpMetrics::eBytesOut, bytes );
+        }
+
+        if ( staging_ )
+        {
+            return stage( data, bytes );
+        }
+
+        if ( sent_bytes_ == 0 && conn_id_ != 0 )
+        {
+            WS_PROBE( first_byte, eTraceFirstByte, conn_id_, bytes, 0 );
+        }
+        sent_bytes_ += bytes;
+        auto ret = client_->send( data, bytes, ms );
+        if ( ret < 0 )
+        {
+            keep_alive_ = false;
+            if ( ms > 0 )
+            {
+                client_->close(); // 限时发送由调用方发起, 连接不属于服务端的连接协程
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * @brief 开始暂存, 处理函数在工作线程中执行时回复先写入内存
+     *
+     * @param[in] event 暂存的数据达到上限时通知连接协程调用flush_stage, 需在end_stage之前保持有效
+    */
+    void begin_stage( CoEvent* event )
+    {
+        staging_      = true;
+        stage_failed_ = false;
+        stage_event_  = event;
+    }
+
+    /**
+     * @brief 暂存的数据是否已达到上限, 需要连接协程发送
+    */
+    bool stage_full()
+    {
+        std::lock_guard<std::mutex> lock( stage_mutex_ );
+        return staged_.length() >= HTTP_STAGE_MAX_BYTES;
+    }
+
+    /**
+     * @brief 发送已暂存的数据并唤醒等待的工作线程, 需在连接协程中调用
+    */
+    int32_t flush_stage()
+    {
+        std::string data;
+        bool first = false;
+        {
+            std::lock_guard<std::mutex> lock( stage_mutex_ );
+            data.swap( staged_ );
+            first = ( data.length() == sent_bytes_ );
+        }
+
+        int32_t ret = TARO_OK;
+        if ( !data.empty() )
+        {
+            if ( first && conn_id_ != 0 )
+            {
+                WS_PROBE( first_byte, eTraceFirstByte, conn_id_, data.length(), 0 );
+            }
+            if ( client_->send( ( char* )data.c_str(), ( uint32_t )data.length() ) < 0 )
+            {
+                ret = TARO_ERR_DISCONNECT;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( stage_mutex_ );
+            if ( ret != TARO_OK )
+            {
+                stage_failed_ = true;
+            }
+            ret = stage_failed_ ? TARO_ERR_DISCONNECT : TARO_OK;
+        }
+        stage_cv_.notify_all();
+        return ret;
+    }
+
+    /**
+     * @brief 结束暂存并发送暂存的数据, 需在连接协程中调用
+    */
+    int32_t end_stage()
     {
+        staging_     = false;
+        stage_event_ = nullptr;
+        return flush_stage();
+    }
 
+    /**
+     * @brief 在工作线程中暂存回复, 达到HTTP_STAGE_MAX_BYTES时通知连接协程发送并等待其完成,
+     *        大回复不会在内存中无限累积
+    */
+    int32_t stage( char* data, uint32_t bytes )
+    {
+        std::unique_lock<std::mutex> lock( stage_mutex_ );
+        sent_bytes_ += bytes;
+        staged_.append( data, bytes );
+        if ( staged_.length() >= HTTP_STAGE_MAX_BYTES && !stage_failed_ && stage_event_ != nullptr )
+        {
+            stage_event_->notify();
+            stage_cv_.wait( lock, [this]()
+            {
+                return staged_.length() < HTTP_STAGE_MAX_BYTES || stage_failed_;
+            } );
+        }
+        return stage_failed_ ? TARO_ERR_DISCONNECT : ( int32_t )bytes;
     }
 
     /**
      * @brief 创建http客户端
+     *
+     * @param[in] opt 服务端的压缩配置 nullptr 表示不压缩
+     * @param[in] enc 请求方可接受的编码
+     * @param[in] metrics 服务端的指标 nullptr 表示不记录
     */
-    static HttpClientSPtr create( net::TcpClientSPtr client )
+    static HttpClientSPtr create( net::TcpClientSPtr client, HttpCompressOpt const* opt = nullptr, EHttpEncoding enc = eHttpEncodingIdentity, HttpMetrics* metrics = nullptr )
     {
         auto http_client = std::make_shared<HttpClient>();
-        http_client->impl_->active_ = false;
-        http_client->impl_->client_ = client;
+        http_client->impl_->active_       = false;
+        http_client->impl_->client_       = client;
+        http_client->impl_->compress_opt_ = opt;
+        http_client->impl_->accept_enc_   = enc;
+        http_client->impl_->metrics_      = metrics;
         return http_client;
     }
 
+    /**
+     * @brief 判断回复是否需要压缩
+     *
+     * @param[out] chunked 回复为chunk传输
+     * @param[out] length  Content-Length
+    */
+    bool should_compress( HttpResponse const& resp, bool& chunked, uint64_t& length ) const
+    {
+        if ( compress_opt_ == nullptr || accept_enc_ == eHttpEncodingIdentity || deflating_ )
+        {
+            return false;
+        }
+
+        auto code = resp.code();
+        if ( code < eHttpRespCodeOK || code == 204 || code == 304 || resp.get<std::string>( "Content-Encoding" ).valid() )
+        {
+            return false;
+        }
+
+        auto type = resp.get<std::string>( "Content-Type" );
+        if ( !type.valid() )
+        {
+            return false;
+        }
+
+        bool matched = false;
+        for ( auto const& one : compress_opt_->mime_types )
+        {
+            matched = matched || ( type.value().compare( 0, one.length(), one ) == 0 );
+        }
+        if ( !matched )
+        {
+            return false;
+        }
+
+        chunked = resp.equal( "Transfer-Encoding", "chunked" );
+        if ( chunked )
+        {
+            return true;
+        }
+
+        auto len = resp.get<uint64_t>( "Content-Length" );
+        if ( !len.valid() || len.value() == 0 || len.value() < compress_opt_->min_bytes )
+        {
+            return false;
+        }
+        length = len.value();
+        return true;
+    }
+
+    /**
+     * @brief 压缩数据并以chunk发送, 结束时发送最后一个chunk
+    */
+    int32_t send_compressed( uint8_t const* data, uint32_t bytes, bool finish )
+    {
+        std::string out;
+        if ( deflater_.feed( data, bytes, finish, out ) != TARO_OK )
+        {
+            return TARO_ERR_FAILED;
+        }
+
+        if ( !out.empty() )
+        {
+            std::stringstream ss;
+            ss << std::hex << out.length() << HTTP_SEP;
+            auto ret = send_framed( *this, ss.str(), ( uint8_t const* )out.c_str(), ( uint32_t )out.length(), HTTP_SEP );
+            if ( ret != TARO_OK )
+            {
+                return ret;
+            }
+        }
+
+        if ( finish )
+        {
+            deflater_.end();
+            deflating_ = false;
+            const char* last_body = "0\r\n\r\n";
+            if ( write( ( char* )last_body, strlen( last_body ) ) < 0 )
+            {
+                return TARO_ERR_DISCONNECT;
+            }
+        }
+        return TARO_OK;
+    }
+
+    /**
+     * @brief 在截止时间内接收回复, 到期时废弃连接并返回TARO_ERR_TIMEOUT
+     *
+     * @param[in] slice 数据体按到达的数据分段返回, body为nullptr表示结束
+    */
+    static HttpRespRet recv_resp( HttpClient& client, Deadline const& dl, bool slice = false );
+
+    /**
+     * @brief 接收回复, 不做解压
+    */
+    static HttpRespRet recv_raw( HttpClient& client, Deadline const& dl, bool slice );
+
+    /**
+     * @brief 等待100 Continue
+     *
+     * @return TARO_OK 收到100 Continue或等待超时 TARO_ERR_FAILED 收到最终回复, 留给recv_resp读取
+    */
+    static int32_t wait_continue( HttpClient& client, Deadline const& dl );
+
+    /**
+     * @brief 是否为1xx临时回复, 101切换协议除外
+    */
+    static bool interim( DynPacketSPtr const& header )
+    {
+        auto data = ( const char* )header->buffer();
+        return header->size() > 12 && data[9] == '1' && !( data[10] == '0' && data[11] == '1' );
+    }
+
+    /**
+     * @brief 接收回复, 数据体分段交给sink, 内存占用与数据体大小无关
+    */
+    static HttpRespRet recv_sink( HttpClient& client, HttpSinkFunc const& sink, Deadline const& dl );
+
+    /**
+     * @brief 接收完整的回复, chunk与boundary回复的数据体合并为一个
+     *
+     * @param[in] dl 整个回复的截止时间
+    */
+    static HttpRespRet recv_whole( HttpClient& client, Deadline const& dl )
+    {
+        std::list<DynPacketSPtr> bodies;
+        while ( 1 )
+        {
+            auto ret = recv_resp( client, dl );
+            if ( ret.ret != TARO_OK )
+            {
+                return ret;
+            }
+
+            if ( ret.body != nullptr )
+            {
+                bodies.push_back( ret.body );
+            }
+
+            if ( client.impl_->parser_.type() == HttpProtoPaser::TYPE_INVALID )
+            {
+                ret.body = merge_packets( bodies );
+                return ret;
+            }
+        }
+    }
+
+    /**
+     * @brief 合并数据包
+    */
+    static DynPacketSPtr merge_packets( std::list<DynPacketSPtr> const& packets )
+    {
+        if ( packets.size() <= 1 )
+        {
+            return packets.empty() ? nullptr : packets.front();
+        }
+
+        uint32_t total = 0;
+        for ( auto const& one : packets )
+        {
+            total += one->size();
+        }
+
+        auto merged = create_default_packet( total );
+        uint32_t offset = 0;
+        for ( auto const& one : packets )
+        {
+            memcpy( ( uint8_t* )merged->buffer() + offset, one->buffer(), one->size() );
+            offset += one->size();
+        }
+        merged->resize( total );
+        return merged;
+    }
+
+    /**
+     * @brief 发送带有前后缀的数据, 小数据合并为一次发送, 大数据分三次发送以避免拷贝, 不修改调用方的数据
+    */
+    static int32_t send_framed( HttpClientImpl& cli, std::string const& prefix, uint8_t const* data, uint32_t bytes, const char* suffix )
+    {
+        if ( bytes <= HTTP_COALESCE_BYTES )
+        {
+            std::string buf;
+            buf.reserve( prefix.length() + bytes + strlen( suffix ) );
+            buf.append( prefix ).append( ( const char* )data, bytes ).append( suffix );
+            return ( cli.write( ( char* )buf.c_str(), buf.length() ) < 0 ) ? TARO_ERR_DISCONNECT : TARO_OK;
+        }
+
+        if ( cli.write( ( char* )prefix.c_str(), prefix.length() ) < 0
+          || cli.write( ( char* )data, bytes ) < 0
+          || cli.write( ( char* )suffix, strlen( suffix ) ) < 0 )
+        {
+            WS_ERROR << "disconnect";
+            return TARO_ERR_DISCONNECT;
+        }
+        return TARO_OK;
+    }
+
+    /**
+     * @brief 废弃连接, 关闭底层连接并禁止复用, 用于取消进行中的请求
+    */
+    static void poison( HttpClient& client )
+    {
+        auto impl = client.impl_;
+        impl->keep_alive_ = false;
+        if ( impl->client_ != nullptr )
+        {
+            impl->client_->close();
+        }
+    }
+
+    /**
+     * @brief 获取内部实现
+    */
+    static HttpClientImpl* get( HttpClient const& client )
+    {
+        return client.impl_;
+    }
+
     bool active_;
+    bool keep_alive_;       // 对端未要求关闭连接
     HttpProtoPaser parser_;
     HttpResponseSPtr resp_;
     net::TcpClientSPtr client_;
     Optional<net::SSLContext> ctx_;
+    std::string pool_key_;  // 所属连接池的主机标识
+    bool decode_;           // 是否解压回复
+    bool inflating_;        // 当前回复正在解压
+    uint64_t decode_limit_; // 解压后的数据体上限
+    HttpInflater inflater_;
+    HttpResponseSPtr decode_resp_; // 正在解压的回复
+    HttpCompressOpt const* compress_opt_; // 服务端的压缩配置
+    EHttpEncoding accept_enc_;     // 请求方可接受的编码
+    bool deflating_;               // 当前回复正在压缩
+    bool deflate_chunked_;         // 原回复为chunk传输
+    uint64_t deflate_remain_;      // Content-Length回复未压缩的字节数
+    HttpDeflater deflater_;
+    bool staging_;                 // 回复暂存在内存中
+    bool stage_failed_;            // 暂存期间发送失败
+    std::string staged_;           // 暂存的回复数据, 工作线程写入, 连接协程发送
+    std::mutex stage_mutex_;
+    std::condition_variable stage_cv_; // 暂存的数据发出后唤醒工作线程
+    CoEvent* stage_event_;         // 暂存的数据达到上限时通知连接协程
+    HttpMetrics* metrics_;         // 服务端的指标, 记录回复状态码与发送字节数
+    int32_t resp_code_;            // 最近发送的回复状态码
+    uint64_t sent_bytes_;          // 已发送的字节数
+    uint64_t conn_id_;             // 服务端连接的跟踪ID, 客户端为0
 };
 
 NAMESPACE_TARO_WS_END
@@ -0,0 +1,314 @@
+﻿
+#pragma once
+
+#include "http_client_pool.h"
+#include "impl/http_client_impl.h"
+#include "impl/co_event.h"
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define HTTP_LATENCY_SAMPLES 256 // 计算对冲延时的耗时样本数
+#define HTTP_LATENCY_MIN     16  // 样本少于该数量时使用初始对冲延时
+#define HTTP_EVICT_INTERVAL  1000 // acquire与release顺带回收空闲连接的最小间隔(ms)
+
+// 空闲连接
+struct HttpPoolItem
+{
+    HttpClientSPtr client;
+    uint64_t       idle_since;
+};
+
+// 单个主机的连接
+struct HttpHostPool
+{
+    HttpHostPool()
+        : total( 0 )
+    {}
+
+    uint32_t total;                // 空闲与使用中的连接总数
+    std::list<HttpPoolItem> idle;  // 空闲连接, 最近归还的在尾部
+};
+
+// 批量请求的共享状态, 截止时间过后仍在进行的请求完成时结果被丢弃
+struct HttpBatchState
+{
+    HttpBatchState()
+        : active( true )
+    {}
+
+    bool active;
+    std::mutex mutex;
+    CoEvent event;                  // 有新的结果时通知
+    std::vector<HttpBatchRet> rets;
+};
+
+using HttpBatchStateSPtr = std::shared_ptr<HttpBatchState>;
+
+// 对冲请求的共享状态
+struct HttpHedgeState
+{
+    HttpHedgeState()
+        : done( false )
+        , running( 0 )
+    {
+        result.ret = TARO_ERR_FAILED;
+    }
+
+    bool done;                          // 已得到回复或超时
+    uint32_t running;                   // 进行中的尝试数
+    std::mutex mutex;
+    CoEvent event;                      // 尝试结束时通知
+    HttpRespRet result;                 // 生效的回复, 全部失败时为最后一次的结果
+    std::list<HttpClientSPtr> clients;  // 进行中的连接, 结束时废弃
+};
+
+using HttpHedgeStateSPtr = std::shared_ptr<HttpHedgeState>;
+
+// 连接池内部实现
+struct HttpClientPoolImpl
+{
+    static std::string make_key( const char* host, uint16_t port, net::SSLContext* ctx )
+    {
+        std::stringstream ss;
+        ss << host << ":" << port << "@" << ( void* )ctx;
+        return ss.str();
+    }
+
+    /**
+     * @brief 空闲连接的健康检查, 空闲连接上不应该有数据, 可读即表示对端关闭或协议错乱
+    */
+    static bool healthy( HttpClientSPtr const& client )
+    {
+        auto impl = HttpClientImpl::get( *client );
+        char byte;
+        auto ret = impl->client_->recv( &byte, 1, 1 );
+        return ret == TARO_ERR_TIMEOUT || ret == TARO_ERR_CONTINUE;
+    }
+
+    /**
+     * @brief 使用连接池中的连接完成一次请求
+    */
+    static HttpRespRet request( HttpClientPool& pool, HttpBatchReq const& item, Deadline const& deadline )
+    {
+        HttpRespRet result;
+        result.ret = TARO_ERR_FAILED;
+
+        auto client = pool.acquire( item.host.c_str(), item.port, item.ctx, deadline.remain() );
+        if ( client == nullptr )
+        {
+            return result;
+        }
+
+        result.ret = client->send_req( *item.req, deadline.remain() );
+        if ( result.ret > 0 && item.body != nullptr )
+        {
+            result.ret = client->send_body( item.body, deadline.remain() );
+        }
+
+        if ( result.ret > 0 )
+        {
+            result = HttpClientImpl::recv_whole( *client, deadline );
+        }
+        else
+        {
+            WS_ERROR << "send request failed";
+        }
+        pool.release( client );
+        return result;
+    }
+
+    /**
+     * @brief 方法是否幂等
+    */
+    static bool idempotent( const char* method )
+    {
+        static const char* methods[] = { "GET", "HEAD", "PUT", "DELETE", "OPTIONS", "TRACE" };
+        for ( auto one : methods )
+        {
+            if ( string_compare( method, one, to_lower ) )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 结束对冲请求, 废弃其余进行中的连接, 需持有state的锁
+    */
+    static void finish( HttpHedgeState& state )
+    {
+        state.done = true;
+        for ( auto& one : state.clients )
+        {
+            HttpClientImpl::poison( *one );
+        }
+        state.clients.clear();
+    }
+
+    /**
+     * @brief 对冲请求的一次尝试
+    */
+    void attempt( HttpClientPool& pool, HttpHedgeStateSPtr const& state, HttpBatchReq const& item, Deadline const& deadline )
+    {
+        uint64_t begin = SystemTime::current_ms();
+        HttpRespRet result;
+        result.ret = TARO_ERR_FAILED;
+
+        auto client = pool.acquire( item.host.c_str(), item.port, item.ctx, deadline.remain() );
+        if ( client != nullptr )
+        {
+            {
+                std::lock_guard<std::mutex> lock( state->mutex );
+                if ( state->done )
+                {
+                    pool.release( client );
+                    --state->running;
+                    return;
+                }
+                state->clients.push_back( client );
+            }
+
+            result.ret = client->send_req( *item.req, deadline.remain() );
+            if ( result.ret > 0 && item.body != nullptr )
+            {
+                result.ret = client->send_body( item.body, deadline.remain() );
+            }
+
+            if ( result.ret > 0 )
+            {
+                result = HttpClientImpl::recv_whole( *client, deadline );
+            }
+        }
+
+        bool success = ( result.ret == TARO_OK && result.resp->code() < eHttpRespCodeInterSvr );
+        if ( success )
+        {
+            add_sample( ( uint32_t )( SystemTime::current_ms() - begin ) );
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( state->mutex );
+            --state->running;
+            if ( client != nullptr )
+            {
+                state->clients.remove( client );
+                pool.release( client );
+            }
+
+            if ( state->done )
+            {
+                return; // 已有其他尝试生效
+            }
+
+            state->result = result;
+            if ( success )
+            {
+                finish( *state );
+            }
+        }
+        state->event.notify();
+    }
+
+    /**
+     * @brief 回收所有主机上空闲超时的连接, 每个主机至少保留min_idle个, 需持有mutex_
+     *
+     * @param[in]  now   当前时间
+     * @param[in]  force 为false时距上次回收不足HTTP_EVICT_INTERVAL则跳过
+     * @param[out] out   被回收的连接, 由调用方在锁外释放, 避免持锁关闭连接
+     * @return 回收的连接数
+    */
+    uint32_t evict_locked( uint64_t now, bool force, std::list<HttpPoolItem>& out )
+    {
+        if ( !force && now - last_evict_ < HTTP_EVICT_INTERVAL )
+        {
+            return 0;
+        }
+        last_evict_ = now;
+
+        uint32_t count = 0;
+        for ( auto& one : hosts_ )
+        {
+            auto& pool = one.second;
+            while ( pool.idle.size() > opt_.min_idle
+                 && now - pool.idle.front().idle_since >= opt_.idle_timeout_ms )
+            {
+                out.splice( out.end(), pool.idle, pool.idle.begin() );
+                --pool.total;
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief 记录成功请求的耗时, 并存入重试令牌
+    */
+    void add_sample( uint32_t cost )
+    {
+        std::lock_guard<std::mutex> lock( hedge_mutex_ );
+        if ( latency_.size() < HTTP_LATENCY_SAMPLES )
+        {
+            latency_.push_back( cost );
+        }
+        else
+        {
+            latency_[latency_pos_] = cost;
+        }
+        latency_pos_ = ( latency_pos_ + 1 ) % HTTP_LATENCY_SAMPLES;
+        tokens_ = std::min<double>( tokens_ + hedge_opt_.budget_ratio, hedge_opt_.budget_burst );
+    }
+
+    /**
+     * @brief 根据最近请求耗时的百分位计算对冲延时
+    */
+    uint32_t hedge_delay()
+    {
+        std::vector<uint32_t> samples;
+        {
+            std::lock_guard<std::mutex> lock( hedge_mutex_ );
+            if ( latency_.size() < HTTP_LATENCY_MIN )
+            {
+                return hedge_opt_.init_delay_ms;
+            }
+            samples = latency_;
+        }
+
+        size_t pos = samples.size() * std::min<uint32_t>( hedge_opt_.percentile, 100 ) / 100;
+        pos = std::min( pos, samples.size() - 1 );
+        std::nth_element( samples.begin(), samples.begin() + pos, samples.end() );
+        return std::max<uint32_t>( samples[pos], 1 );
+    }
+
+    /**
+     * @brief 取出一个重试令牌
+    */
+    bool take_token()
+    {
+        std::lock_guard<std::mutex> lock( hedge_mutex_ );
+        if ( tokens_ < 1.0 )
+        {
+            return false;
+        }
+        tokens_ -= 1.0;
+        return true;
+    }
+
+    HttpPoolOpt opt_;
+    mutable std::mutex mutex_;
+    std::map<std::string, HttpHostPool> hosts_;
+    CoEvent slot_event_;            // 连接归还或释放时通知等待的acquire
+    uint64_t last_evict_;           // 上次回收空闲连接的时间
+
+    std::mutex hedge_mutex_;
+    HttpHedgeOpt hedge_opt_;
+    double tokens_;                 // 重试令牌
+    uint32_t latency_pos_;          // 下一个耗时样本的位置
+    std::vector<uint32_t> latency_; // 最近成功请求的耗时
+};
+
+NAMESPACE_TARO_WS_END
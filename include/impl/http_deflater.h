@@ -0,0 +1,216 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <base/utils/string_tool.h>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <zlib.h>
+#if defined( WS_USE_BROTLI )
+#include <brotli/encode.h>
+#endif
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define HTTP_DEFLATE_BUF_SIZE 0x4000 // 单次压缩输出的大小
+
+// 内容编码
+enum EHttpEncoding
+{
+    eHttpEncodingIdentity,
+    eHttpEncodingGzip,
+    eHttpEncodingBrotli,
+};
+
+// 回复的流式压缩, 输出gzip或brotli(编译时开启WS_USE_BROTLI)
+class HttpDeflater
+{
+PUBLIC: // function
+
+    HttpDeflater()
+        : encoding_( eHttpEncodingIdentity )
+#if defined( WS_USE_BROTLI )
+        , br_( nullptr )
+#endif
+    {
+        memset( &zs_, 0, sizeof( zs_ ) );
+    }
+
+    ~HttpDeflater()
+    {
+        end();
+    }
+
+    /**
+     * @brief Accept-Encoding是否接受该编码, q=0表示不接受
+    */
+    static bool accepts( std::string const& accept, const char* encoding )
+    {
+        for ( auto const& one : split_string( accept, "," ) )
+        {
+            auto pos   = one.find( ';' );
+            auto token = string_trim( one.substr( 0, pos ) );
+            if ( token != "*" && !string_compare( token, encoding, to_lower ) )
+            {
+                continue;
+            }
+
+            auto q = ( pos == std::string::npos ) ? std::string::npos : one.find( "q=", pos );
+            return q == std::string::npos || atof( one.c_str() + q + 2 ) > 0.0;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 根据Accept-Encoding选择编码, 优先brotli
+    */
+    static EHttpEncoding negotiate( std::string const& accept )
+    {
+#if defined( WS_USE_BROTLI )
+        if ( accepts( accept, "br" ) )
+            return eHttpEncodingBrotli;
+#endif
+        if ( accepts( accept, "gzip" ) || accepts( accept, "x-gzip" ) )
+            return eHttpEncodingGzip;
+        return eHttpEncodingIdentity;
+    }
+
+    /**
+     * @brief 编码在Content-Encoding中的名称
+    */
+    static const char* name( EHttpEncoding encoding )
+    {
+        switch ( encoding )
+        {
+        case eHttpEncodingGzip:   return "gzip";
+        case eHttpEncodingBrotli: return "br";
+        default:                  return "identity";
+        }
+    }
+
+    /**
+     * @brief 开始压缩新的数据流
+     * 
+     * @param[in] level 压缩等级 1-9
+    */
+    bool begin( EHttpEncoding encoding, int32_t level )
+    {
+        end();
+        if ( encoding == eHttpEncodingGzip )
+        {
+            // 15 + 16 输出gzip格式
+            if ( deflateInit2( &zs_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+            {
+                return false;
+            }
+        }
+#if defined( WS_USE_BROTLI )
+        else if ( encoding == eHttpEncodingBrotli )
+        {
+            br_ = BrotliEncoderCreateInstance( nullptr, nullptr, nullptr );
+            if ( br_ == nullptr )
+            {
+                return false;
+            }
+            // brotli等级为0-11, 动态内容使用与gzip相当的中等等级
+            BrotliEncoderSetParameter( br_, BROTLI_PARAM_QUALITY, ( uint32_t )std::min( level, 11 ) );
+        }
+#endif
+        else
+        {
+            return false;
+        }
+        encoding_ = encoding;
+        return true;
+    }
+
+    /**
+     * @brief 输入数据, 压缩结果追加到out
+     * 
+     * @param[in] finish 是否为最后的数据
+    */
+    int32_t feed( uint8_t const* data, uint32_t bytes, bool finish, std::string& out )
+    {
+        uint8_t chunk[HTTP_DEFLATE_BUF_SIZE];
+        if ( encoding_ == eHttpEncodingGzip )
+        {
+            zs_.next_in  = ( Bytef* )data;
+            zs_.avail_in = bytes;
+            int32_t flush = finish ? Z_FINISH : Z_SYNC_FLUSH; // 同步刷新, 每段数据可以立即解压
+            int32_t ret   = Z_OK;
+            do
+            {
+                zs_.next_out  = chunk;
+                zs_.avail_out = sizeof( chunk );
+                ret = deflate( &zs_, flush );
+                if ( ret == Z_STREAM_ERROR )
+                {
+                    WS_ERROR << "deflate failed";
+                    return TARO_ERR_FAILED;
+                }
+                out.append( ( const char* )chunk, sizeof( chunk ) - zs_.avail_out );
+            } while ( zs_.avail_out == 0 || ( finish && ret != Z_STREAM_END ) );
+            return TARO_OK;
+        }
+#if defined( WS_USE_BROTLI )
+        if ( encoding_ == eHttpEncodingBrotli )
+        {
+            size_t avail_in = bytes;
+            uint8_t const* next_in = data;
+            auto op = finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH;
+            do
+            {
+                size_t avail_out = sizeof( chunk );
+                uint8_t* next_out = chunk;
+                if ( !BrotliEncoderCompressStream( br_, op, &avail_in, &next_in, &avail_out, &next_out, nullptr ) )
+                {
+                    WS_ERROR << "brotli compress failed";
+                    return TARO_ERR_FAILED;
+                }
+                out.append( ( const char* )chunk, sizeof( chunk ) - avail_out );
+            } while ( avail_in > 0 || BrotliEncoderHasMoreOutput( br_ ) || ( finish && !BrotliEncoderIsFinished( br_ ) ) );
+            return TARO_OK;
+        }
+#endif
+        return TARO_ERR_INVALID_RES;
+    }
+
+    /**
+     * @brief 结束压缩并释放资源
+    */
+    void end()
+    {
+        if ( encoding_ == eHttpEncodingGzip )
+        {
+            deflateEnd( &zs_ );
+        }
+#if defined( WS_USE_BROTLI )
+        if ( br_ != nullptr )
+        {
+            BrotliEncoderDestroyInstance( br_ );
+            br_ = nullptr;
+        }
+#endif
+        encoding_ = eHttpEncodingIdentity;
+    }
+
+    EHttpEncoding encoding() const
+    {
+        return encoding_;
+    }
+
+PRIVATE: // function
+
+    TARO_NO_COPY( HttpDeflater );
+
+PRIVATE: // variable
+
+    EHttpEncoding encoding_;
+    z_stream      zs_;
+#if defined( WS_USE_BROTLI )
+    BrotliEncoderState* br_;
+#endif
+};
+
+NAMESPACE_TARO_WS_END
@@ -0,0 +1,168 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <base/memory/dyn_packet.h>
+#include <base/utils/string_tool.h>
+#include <cstring>
+#include <zlib.h>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define HTTP_INFLATE_BUF_SIZE 0x4000 // 单次解压输出的大小
+
+// gzip/deflate流式解压, 数据可以分段输入, 解压后的总大小超过上限时失败
+class HttpInflater
+{
+PUBLIC: // function
+
+    HttpInflater()
+        : active_( false )
+        , raw_tried_( false )
+        , finished_( false )
+        , total_( 0 )
+        , limit_( 0 )
+    {
+        memset( &zs_, 0, sizeof( zs_ ) );
+    }
+
+    ~HttpInflater()
+    {
+        end();
+    }
+
+    /**
+     * @brief 是否支持该编码
+    */
+    static bool supported( std::string const& encoding )
+    {
+        auto str = string_trim( encoding );
+        return string_compare( str, "gzip", to_lower )
+            || string_compare( str, "x-gzip", to_lower )
+            || string_compare( str, "deflate", to_lower );
+    }
+
+    /**
+     * @brief 开始解压新的数据流
+     * 
+     * @param[in] limit 解压后的最大字节数
+    */
+    bool begin( uint64_t limit )
+    {
+        end();
+        total_     = 0;
+        limit_     = limit;
+        raw_tried_ = false;
+        finished_  = false;
+        // 15 + 32 自动识别gzip与zlib头
+        active_ = ( inflateInit2( &zs_, 15 + 32 ) == Z_OK );
+        return active_;
+    }
+
+    /**
+     * @brief 输入压缩数据
+     * 
+     * @param[out] out 解压得到的数据 nullptr 表示暂无输出
+     * @return TARO_OK 成功 TARO_ERR_FORMAT 数据错误 TARO_ERR_INVALID_ARG 超过大小上限
+    */
+    int32_t feed( uint8_t const* data, uint32_t bytes, DynPacketSPtr& out )
+    {
+        TARO_ASSERT( active_ );
+
+        out.reset();
+        buffer_.clear();
+        zs_.next_in  = ( Bytef* )data;
+        zs_.avail_in = bytes;
+        while ( !finished_ )
+        {
+            uint8_t chunk[HTTP_INFLATE_BUF_SIZE];
+            zs_.next_out  = chunk;
+            zs_.avail_out = sizeof( chunk );
+            auto ret = inflate( &zs_, Z_NO_FLUSH );
+            if ( ret == Z_DATA_ERROR && !raw_tried_ && zs_.total_out == 0 )
+            {
+                // 部分服务端的deflate没有zlib头, 改为原始deflate重新解压
+                raw_tried_ = true;
+                inflateEnd( &zs_ );
+                if ( inflateInit2( &zs_, -MAX_WBITS ) != Z_OK )
+                {
+                    active_ = false;
+                    return TARO_ERR_FORMAT;
+                }
+                zs_.next_in  = ( Bytef* )data;
+                zs_.avail_in = bytes;
+                continue;
+            }
+
+            if ( ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR )
+            {
+                WS_ERROR << "inflate failed, ret:" << ret;
+                return TARO_ERR_FORMAT;
+            }
+
+            uint32_t produced = ( uint32_t )( sizeof( chunk ) - zs_.avail_out );
+            total_ += produced;
+            if ( total_ > limit_ )
+            {
+                WS_ERROR << "decompressed size exceeds limit:" << limit_;
+                return TARO_ERR_INVALID_ARG;
+            }
+            buffer_.append( ( const char* )chunk, produced );
+
+            finished_ = ( ret == Z_STREAM_END );
+            if ( zs_.avail_out > 0 && ( zs_.avail_in == 0 || ret == Z_BUF_ERROR ) )
+            {
+                break; // 输入已用完
+            }
+        }
+
+        if ( !buffer_.empty() )
+        {
+            out = create_default_packet( ( uint32_t )buffer_.length() );
+            memcpy( out->buffer(), buffer_.c_str(), buffer_.length() );
+            out->resize( ( uint32_t )buffer_.length() );
+        }
+        return TARO_OK;
+    }
+
+    /**
+     * @brief 数据流是否完整结束
+    */
+    bool finished() const
+    {
+        return finished_;
+    }
+
+    bool active() const
+    {
+        return active_;
+    }
+
+    /**
+     * @brief 结束解压并释放资源
+    */
+    void end()
+    {
+        if ( active_ )
+        {
+            inflateEnd( &zs_ );
+            active_ = false;
+        }
+    }
+
+PRIVATE: // function
+
+    TARO_NO_COPY( HttpInflater );
+
+PRIVATE: // variable
+
+    bool        active_;
+    bool        raw_tried_;
+    bool        finished_;
+    uint64_t    total_;
+    uint64_t    limit_;
+    z_stream    zs_;
+    std::string buffer_;
+};
+
+NAMESPACE_TARO_WS_END
@@ -0,0 +1,200 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define METRIC_SHARDS      16  // 计数器的分片数, 线程按序号分散到各分片
+#define METRIC_HIST_OCTAVE 47  // 直方图记录的最大值为2^47
+#define METRIC_HIST_SUB    4   // 直方图每个2的幂区间的子桶数
+#define METRIC_HIST_BUCKETS ( METRIC_HIST_SUB + ( METRIC_HIST_OCTAVE - 1 ) * METRIC_HIST_SUB )
+#define METRIC_STATUS_MAX  600 // 记录的最大状态码
+
+/**
+ * @brief 当前线程使用的分片, 线程首次调用时按序号分配
+*/
+inline uint32_t metric_shard()
+{
+    static std::atomic<uint32_t> next( 0 );
+    static thread_local uint32_t shard = next++ % METRIC_SHARDS;
+    return shard;
+}
+
+/**
+ * @brief 单调时钟(ns)
+*/
+inline uint64_t metric_now_ns()
+{
+    return ( uint64_t )std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// 按线程分片的计数器组, 记录时只写本线程的分片, 读取时合并所有分片
+template<uint32_t N>
+class MetricArray
+{
+PUBLIC: // function
+
+    void add( uint32_t index, uint64_t value = 1 )
+    {
+        rows_[metric_shard()].v[index].fetch_add( value, std::memory_order_relaxed );
+    }
+
+    uint64_t value( uint32_t index ) const
+    {
+        uint64_t sum = 0;
+        for ( auto const& row : rows_ )
+        {
+            sum += row.v[index].load( std::memory_order_relaxed );
+        }
+        return sum;
+    }
+
+PRIVATE: // type
+
+    // 分片之间以一个缓存行隔开, 避免不同线程间的伪共享
+    // 不使用alignas, C++11的new不保证扩展对齐
+    struct Row
+    {
+        Row()
+        {
+            for ( auto& one : v )
+            {
+                one.store( 0, std::memory_order_relaxed );
+            }
+        }
+
+        std::atomic<uint64_t> v[N];
+        char pad[64];
+    };
+
+PRIVATE: // variable
+
+    Row rows_[METRIC_SHARDS];
+};
+
+using MetricCounter = MetricArray<1>;
+
+// 对数分桶的直方图, 每个2的幂区间分为METRIC_HIST_SUB个子桶, 相对误差不超过25%
+class MetricHistogram
+{
+PUBLIC: // function
+
+    void record( uint64_t value )
+    {
+        buckets_.add( index( value ) );
+        buckets_.add( METRIC_HIST_BUCKETS, value );
+    }
+
+    /**
+     * @brief 以Prometheus文本格式输出, 记录值的单位为ns, 输出的单位为秒
+     *        各分片先合并为一份快照再累加, 边界固定为1us至68s之间的2的幂
+     *
+     * @param[in] name   指标名
+     * @param[in] labels 额外的标签 例如 route="/a", 可以为空
+    */
+    void render( std::stringstream& ss, const char* name, std::string const& labels ) const
+    {
+        uint64_t buckets[METRIC_HIST_BUCKETS];
+        for ( uint32_t i = 0; i < METRIC_HIST_BUCKETS; ++i )
+        {
+            buckets[i] = buckets_.value( i );
+        }
+
+        std::string sep = labels.empty() ? "" : ",";
+        uint64_t count = 0;
+        uint32_t index = 0;
+        for ( uint32_t bits = 10; bits <= 36; ++bits )
+        {
+            // 2^bits恰好是第( bits - 1 ) * METRIC_HIST_SUB个桶的起点
+            for ( uint32_t end = ( bits - 1 ) * METRIC_HIST_SUB; index < end; ++index )
+            {
+                count += buckets[index];
+            }
+            ss << name << "_bucket{" << labels << sep << "le=\"" << ( double )( 1ULL << bits ) / 1e9 << "\"} " << count << "\n";
+        }
+        for ( ; index < METRIC_HIST_BUCKETS; ++index )
+        {
+            count += buckets[index];
+        }
+
+        auto braced = labels.empty() ? std::string() : "{" + labels + "}";
+        ss << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << count << "\n";
+        ss << name << "_sum" << braced << " " << ( double )buckets_.value( METRIC_HIST_BUCKETS ) / 1e9 << "\n";
+        ss << name << "_count" << braced << " " << count << "\n";
+    }
+
+PRIVATE: // function
+
+    static uint32_t index( uint64_t value )
+    {
+        if ( value < METRIC_HIST_SUB )
+        {
+            return ( uint32_t )value;
+        }
+
+#if defined( __GNUC__ )
+        uint32_t msb = 63 - ( uint32_t )__builtin_clzll( value );
+#else
+        uint32_t msb = 63;
+        while ( !( value >> msb ) )
+        {
+            --msb;
+        }
+#endif
+        if ( msb >= METRIC_HIST_OCTAVE )
+        {
+            return METRIC_HIST_BUCKETS - 1;
+        }
+        uint32_t sub = ( uint32_t )( value >> ( msb - 2 ) ) & ( METRIC_HIST_SUB - 1 );
+        return METRIC_HIST_SUB + ( msb - 2 ) * METRIC_HIST_SUB + sub;
+    }
+
+PRIVATE: // variable
+
+    MetricArray<METRIC_HIST_BUCKETS + 1> buckets_; // 最后一个为总和
+};
+
+// 路径级别的指标
+struct RouteMetrics
+{
+    MetricCounter requests;
+    MetricHistogram handler_ns; // 处理函数耗时, 卸载时包括排队时间
+};
+
+// 服务级别的指标
+struct HttpMetrics
+{
+    enum
+    {
+        eAccepts,
+        eBytesIn,
+        eBytesOut,
+        eUnmatched,
+        eWsFramesIn,
+        eCount,
+    };
+
+    void add( uint32_t index, uint64_t value = 1 )
+    {
+        counters.add( index, value );
+    }
+
+    void add_status( int32_t code )
+    {
+        if ( code > 0 && code < METRIC_STATUS_MAX )
+        {
+            status.add( ( uint32_t )code );
+        }
+    }
+
+    MetricArray<eCount> counters;
+    MetricArray<METRIC_STATUS_MAX> status;
+    MetricHistogram parse_ns;   // 请求头解析耗时
+};
+
+NAMESPACE_TARO_WS_END
@@ -6,6 +6,7 @@
 #include <base/memory/pakcet_list.h>
 #include <map>
 #include <vector>
+#include <algorithm>
 
 #define HTTP_END_FLAG         "\r\n\r\n"
 #define HTTP_SEP              "\r\n"
@@ -15,6 +16,8 @@
 #define HTTP_CONTENT_CHUNK    "Transfer-Encoding: chunked"
 #define HTTP_CONTENT_BOUNDARY "multipart/form-data; boundary="
 #define HTTP_UPGRADE          "Upgrade"
+#define HTTP_CONTINUE_RESP    "HTTP/1.1 100 Continue\r\n\r\n"
+#define HTTP_EXPECT_CONTINUE  "100-continue"
 
 NAMESPACE_TARO_WS_BEGIN
 
@@ -35,6 +38,11 @@ PUBLIC: // function
         return iter->second;
     }
 
+    static bool contains( int32_t code )
+    {
+        return instance().state_.count( code ) > 0;
+    }
+
 PRIVATE: // function
 
     static HttpRespState& instance()
@@ -45,12 +53,16 @@ PRIVATE: // function
 
     HttpRespState()
     {
+        state_[eHttpRespCodeContinue]   = HTTP_MSG_CONTINUE;
         state_[eHttpRespCodeOK]         = HTTP_MSG_OK;
         state_[eHttpRespCodeRedirect]   = HTTP_MSG_REDIR;
         state_[eHttpRespCodeBadReq]     = HTTP_MSG_BADREQ;
         state_[eHttpRespCodeUnauth]     = HTTP_MSG_UNAUTH;
         state_[eHttpRespCodeForbidden]  = HTTP_MSG_FORBINDDEN;
         state_[eHttpRespCodeNotFound]   = HTTP_MSG_NOTFOUND;
+        state_[eHttpRespCodeTooLarge]   = HTTP_MSG_TOO_LARGE;
+        state_[eHttpRespCodeExpectFail] = HTTP_MSG_EXPECT_FAIL;
+        state_[eHttpRespCodeTooMany]    = HTTP_MSG_TOO_MANY;
         state_[eHttpRespCodeInterSvr]   = HTTP_MSG_INTER_SVR;
         state_[eHttpRespCodeSvrUnavail] = HTTP_MSG_SVR_UNAVAIL;
     }
@@ -78,7 +90,7 @@ inline bool parse_header( std::string header, std::vector<BodyItem>& header_item
         auto pos1 = line.find_first_of(":");
         if ( pos1 == std::string::npos )
         {
-            WS_ERROR << "header format error:" << line;
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "header format error:" << line;
         }
         else
         {
@@ -89,6 +101,11 @@ inline bool parse_header( std::string header, std::vector<BodyItem>& header_item
     return true;
 }
 
+inline bool str_equal( std::string const& left, const char* right )
+{
+    return string_compare( left, right, to_lower );
+}
+
 struct HttpRequestImpl
 {
     static std::string serialize( HttpRequest const& req )
@@ -100,6 +117,49 @@ struct HttpRequestImpl
         return ss.str();
     }
 
+    /**
+     * @brief 序列化请求, 缺少Content-Length时按数据体长度补充
+    */
+    static std::string serialize( HttpRequest const& req, uint32_t body_bytes )
+    {
+        auto impl = req.impl_;
+        std::stringstream ss;
+        ss << impl->method_ << " " << impl->url_ << " " << impl->version_ << HTTP_SEP;
+
+        bool has_len = false;
+        for ( auto& one : impl->body_items_ )
+        {
+            has_len = has_len || str_equal( one.key, "Content-Length" );
+            ss << one.key << ": " << one.value << HTTP_SEP;
+        }
+
+        if ( !has_len && body_bytes > 0 )
+        {
+            ss << "Content-Length: " << body_bytes << HTTP_SEP;
+        }
+        ss << HTTP_SEP;
+        return ss.str();
+    }
+
+    /**
+     * @brief 序列化请求并声明Expect: 100-continue, 替换请求中已有的Expect
+    */
+    static std::string serialize_expect( HttpRequest const& req )
+    {
+        auto impl = req.impl_;
+        std::stringstream ss;
+        ss << impl->method_ << " " << impl->url_ << " " << impl->version_ << HTTP_SEP;
+        for ( auto& one : impl->body_items_ )
+        {
+            if ( !str_equal( one.key, "Expect" ) )
+            {
+                ss << one.key << ": " << one.value << HTTP_SEP;
+            }
+        }
+        ss << "Expect: " << HTTP_EXPECT_CONTINUE << HTTP_SEP << HTTP_SEP;
+        return ss.str();
+    }
+
     static bool deserialize( HttpRequest& req, DynPacketSPtr const& packet )
     {
         std::string http_str( ( char* )packet->buffer(), packet->size() );
@@ -107,7 +167,7 @@ struct HttpRequestImpl
         auto pos = http_str.find( HTTP_SEP );
         if ( pos == std::string::npos )
         {
-            WS_ERROR << "can not find request line.";
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "can not find request line.";
             return false;
         }
 
@@ -115,7 +175,7 @@ struct HttpRequestImpl
         auto splited = split_string( line );
         if ( splited.size() != 3 )
         {
-            WS_ERROR << "parse request line failed. header:" << line;
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "parse request line failed. header:" << line;
             return false;
         }
         req.impl_->method_  = string_trim( splited[0] );
@@ -143,13 +203,47 @@ struct HttpResponseImpl
         return ss.str();
     }
 
+    /**
+     * @brief 序列化压缩后的回复头, 去掉Content-Length, 改为chunk传输并声明编码
+    */
+    static std::string serialize_encoded( HttpResponse const& resp, const char* encoding )
+    {
+        auto impl = resp.impl_;
+        std::stringstream ss;
+        ss << impl->version_ << " " << impl->code_ << " " << impl->state_ << HTTP_SEP;
+
+        bool has_vary = false, has_chunk = false;
+        for ( auto& one : impl->body_items_ )
+        {
+            if ( str_equal( one.key, "Content-Length" ) )
+            {
+                continue;
+            }
+            has_vary  = has_vary  || str_equal( one.key, "Vary" );
+            has_chunk = has_chunk || str_equal( one.key, "Transfer-Encoding" );
+            ss << one.key << ": " << one.value << HTTP_SEP;
+        }
+
+        ss << "Content-Encoding: " << encoding << HTTP_SEP;
+        if ( !has_chunk )
+        {
+            ss << HTTP_CONTENT_CHUNK << HTTP_SEP;
+        }
+        if ( !has_vary )
+        {
+            ss << "Vary: Accept-Encoding" << HTTP_SEP;
+        }
+        ss << HTTP_SEP;
+        return ss.str();
+    }
+
     static bool deserialize( HttpResponse& resp, DynPacketSPtr const& packet )
     {
         std::string http_str( ( char* )packet->buffer(), packet->size() );
         auto pos = http_str.find( HTTP_SEP );
         if ( pos == std::string::npos )
         {
-            WS_ERROR << "can not find request line.";
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "can not find request line.";
             return false;
         }
 
@@ -157,7 +251,7 @@ struct HttpResponseImpl
         auto splited = split_string( line );
         if ( splited.size() < 3 )
         {
-            WS_ERROR << "parse request line failed.";
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "parse request line failed.";
             return false;
         }
 
@@ -204,7 +298,10 @@ PUBLIC:  // function
 
     HttpProtoPaser()
         : type_( TYPE_INVALID )
+        , body_bytes_( -1 )
         , chunk_bytes_( -1 )
+        , chunk_tail_( false )
+        , boundary_part_( false )
     {
 
     }
@@ -219,7 +316,7 @@ PUBLIC:  // function
         pktlist_.append( packet );
     }
 
-    int32_t rest_bytes()
+    int32_t rest_bytes() const
     {
         return pktlist_.size();
     }
@@ -254,7 +351,7 @@ PUBLIC:  // function
             std::string tmp;
             if ( read_value( len_begin + ( uint32_t )strlen( HTTP_CONTENT_BOUNDARY ), tmp ) != TARO_OK )
             {
-                WS_ERROR << "boundary not found.";
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "boundary not found.";
                 pktlist_.consume( total_len ); // drop the packet
                 return TARO_ERR_INVALID_ARG;
             }
@@ -263,10 +360,10 @@ PUBLIC:  // function
         }
         else if ( pktlist_.search( HTTP_CONTENT_LEN, 0, len_begin, str_cmp ) )
         {
-            int32_t tmp = -1;
+            int64_t tmp = -1;
             if ( ( read_value( len_begin + ( uint32_t )strlen( HTTP_CONTENT_LEN ), tmp ) != TARO_OK ) || tmp < 0 )
             {
-                WS_ERROR << "content length not found.";
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "content length not found.";
                 pktlist_.consume( total_len ); // drop the packet
                 return TARO_ERR_INVALID_ARG;
             }
@@ -289,6 +386,14 @@ PUBLIC:  // function
         return header_;
     }
 
+    /**
+     * @brief 未读取的Content-Length数据体长度
+    */
+    int64_t body_bytes() const
+    {
+        return body_bytes_;
+    }
+
     int32_t get_content( DynPacketSPtr& packet )
     {
         TARO_ASSERT( type_ == TYPE_NORMAL );
@@ -299,18 +404,73 @@ PUBLIC:  // function
             return TARO_OK;
         }
 
+        if ( body_bytes_ > UINT32_MAX )
+        {
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "content too large to buffer:" << body_bytes_;
+            return TARO_ERR_INVALID_ARG;
+        }
+
         if ( pktlist_.size() < body_bytes_ )
         {
             return TARO_ERR_CONTINUE;
         }
 
-        packet = pktlist_.read( body_bytes_ );
+        packet = pktlist_.read( ( uint32_t )body_bytes_ );
         return TARO_OK;
     }
 
-    int32_t get_chunk( DynPacketSPtr& packet )
+    /**
+     * @brief 按到达的数据分段读取Content-Length数据体, 不缓存整个数据体
+     * 
+     * @param[out] packet      本段数据 nullptr 表示数据体已读完
+     * @param[in]  slice_bytes 每段的长度, 数据不足一段时等待(最后一段除外) 0 表示读取已到达的全部数据
+    */
+    int32_t get_content_slice( DynPacketSPtr& packet, uint32_t slice_bytes = 0 )
+    {
+        TARO_ASSERT( type_ == TYPE_NORMAL );
+
+        packet = DynPacketSPtr();
+        if ( body_bytes_ <= 0 )
+        {
+            return TARO_OK;
+        }
+
+        auto bytes = ( uint32_t )std::min<int64_t>( pktlist_.size(), body_bytes_ );
+        auto want  = ( slice_bytes == 0 ) ? 1 : ( uint32_t )std::min<int64_t>( slice_bytes, body_bytes_ );
+        if ( bytes < want )
+        {
+            return TARO_ERR_CONTINUE;
+        }
+
+        if ( slice_bytes > 0 )
+        {
+            bytes = want;
+        }
+        packet = pktlist_.read( bytes );
+        body_bytes_ -= bytes;
+        return TARO_OK;
+    }
+
+    /**
+     * @brief 读取chunk数据体
+     * 
+     * @param[out] packet 数据 nullptr 表示最后一包
+     * @param[in]  slice  按到达的数据分段读取, 不等待整个chunk
+    */
+    int32_t get_chunk( DynPacketSPtr& packet, bool slice = false )
     {
         TARO_ASSERT( type_ == TYPE_CHUNK );
+
+        // 分段读取时chunk数据后的\r\n可能尚未到达
+        if ( chunk_tail_ )
+        {
+            if ( pktlist_.size() < HTTP_SEP_LEN )
+            {
+                return TARO_ERR_CONTINUE;
+            }
+            pktlist_.consume( HTTP_SEP_LEN );
+            chunk_tail_ = false;
+        }
         
         // chunk format: [chunk size][\r\n][chunk data][\r\n][chunk size][\r\n][chunk data][\r\n][chunk size = 0][\r\n][\r\n]
         if ( chunk_bytes_ < 0 )
@@ -318,7 +478,7 @@ PUBLIC:  // function
             auto ret = read_value( 0, chunk_bytes_, true, true );
             if ( ret == TARO_ERR_FORMAT )
             {
-                WS_ERROR << "read chunk size failed";
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "read chunk size failed";
                 return TARO_ERR_INVALID_ARG;
             }
 
@@ -329,7 +489,7 @@ PUBLIC:  // function
 
             if ( chunk_bytes_ < 0 )
             {
-                WS_ERROR << "chunk value invalid.";
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "chunk value invalid.";
                 return TARO_ERR_INVALID_ARG;
             }
         }
@@ -341,6 +501,24 @@ PUBLIC:  // function
             return TARO_OK;
         }
 
+        if ( slice )
+        {
+            if ( pktlist_.size() == 0 )
+            {
+                return TARO_ERR_CONTINUE;
+            }
+
+            auto bytes = std::min<uint32_t>( pktlist_.size(), ( uint32_t )chunk_bytes_ );
+            packet = pktlist_.read( bytes );
+            chunk_bytes_ -= bytes;
+            if ( chunk_bytes_ == 0 )
+            {
+                chunk_bytes_ = -1;
+                chunk_tail_  = true;
+            }
+            return TARO_OK;
+        }
+
         if ( chunk_bytes_ + HTTP_SEP_LEN > pktlist_.size() )
         {
             return TARO_ERR_CONTINUE;
@@ -381,12 +559,72 @@ PUBLIC:  // function
         return TARO_OK;
     }
 
+    /**
+     * @brief 按到达的数据分段读取boundary数据体, 内存中只保留可能构成分隔符的尾部
+     * 
+     * @param[out] packet   本段数据, 可能为nullptr
+     * @param[out] part_end 当前part已结束
+     * @return TARO_OK 且packet为nullptr part_end为false 表示数据体已读完
+    */
+    int32_t get_boundary_slice( DynPacketSPtr& packet, bool& part_end )
+    {
+        TARO_ASSERT( type_ == TYPE_BOUNDARY );
+
+        packet   = DynPacketSPtr();
+        part_end = false;
+        std::string flag = "--";
+        flag += boundary_;
+        if ( !boundary_part_ )
+        {
+            uint32_t pos = 0;
+            char tail[2] = { 0 };
+            if ( !pktlist_.search( flag.c_str(), 0, pos )
+              || pktlist_.try_read( ( uint8_t* )tail, 2, pos + ( uint32_t )flag.length() ) < 2 )
+            {
+                return TARO_ERR_CONTINUE;
+            }
+
+            if ( tail[0] == '-' && tail[1] == '-' )
+            {
+                pktlist_.consume( std::min<uint32_t>( pos + ( uint32_t )flag.length() + 2 + HTTP_SEP_LEN, pktlist_.size() ) );
+                return TARO_OK;
+            }
+            pktlist_.consume( pos + ( uint32_t )flag.length() + HTTP_SEP_LEN );
+            boundary_part_ = true;
+        }
+
+        // part数据以\r\n--boundary结束
+        std::string delim = HTTP_SEP + flag;
+        uint32_t pos = 0;
+        if ( pktlist_.search( delim.c_str(), 0, pos ) )
+        {
+            if ( pos > 0 )
+            {
+                packet = pktlist_.read( pos );
+            }
+            pktlist_.consume( HTTP_SEP_LEN );
+            boundary_part_ = false;
+            part_end       = true;
+            return TARO_OK;
+        }
+
+        auto keep = ( uint32_t )delim.length() - 1;
+        if ( pktlist_.size() <= keep )
+        {
+            return TARO_ERR_CONTINUE;
+        }
+        packet = pktlist_.read( pktlist_.size() - keep );
+        return TARO_OK;
+    }
+
     void reset()
     {
         type_ = TYPE_INVALID;
         header_.reset();
         body_bytes_ = -1;
         boundary_ = "";
+        chunk_tail_ = false;
+        boundary_part_ = false;
     }
 
 PRIVATE: // function
@@ -432,10 +670,12 @@ PRIVATE: // variable
 
     HttpProtoType type_;
     DynPacketSPtr header_;
-    int32_t       body_bytes_;
+    int64_t       body_bytes_;  // 未读取的数据体长度
     std::string   boundary_;
     PacketList    pktlist_;
     int32_t       chunk_bytes_;
+    bool          chunk_tail_;  // 等待chunk数据后的\r\n
+    bool          boundary_part_; // 分段读取boundary时正在读取part数据
 };
 
 NAMESPACE_TARO_WS_END
@@ -0,0 +1,269 @@
+﻿
+#pragma once
+
+#include "web_server.h"
+#include "impl/http_proto_impl.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define RATE_TABLE_SHARDS 64 // 令牌桶表的分片数
+#define RATE_TABLE_PROBE  8  // 查找key时在分片内探测的槽数
+#define RATE_NEWER_WINDOW 0x10000 // 桶的时间晚于当前时间不超过该值(ms)时视为其他线程并发写入
+
+// 无锁令牌桶表, 固定容量, 按key的哈希值分片并开放寻址
+// 探测范围内没有空槽时淘汰最久未使用的槽, 大量不同key涌入时内存与单次开销不变
+// 哈希冲突或淘汰竞争时两个key可能短暂共用一个桶, 限速结果是近似的
+class TokenTable
+{
+PUBLIC: // function
+
+    /**
+     * @brief 构造函数
+     *
+     * @param[in] rate     每秒补充的令牌数
+     * @param[in] burst    桶容量
+     * @param[in] capacity 总槽数, 向上取整到分片数与2的幂
+    */
+    TokenTable( double rate, uint32_t burst, uint32_t capacity )
+        : rate_milli_( rate )
+        , burst_milli_( ( uint64_t )std::min<uint32_t>( burst, UINT32_MAX / 1000 ) * 1000 )
+        , base_ms_( now_ms() - 1 )
+    {
+        uint32_t per_shard = 1;
+        while ( per_shard * RATE_TABLE_SHARDS < capacity )
+        {
+            per_shard <<= 1;
+        }
+        shard_mask_ = per_shard - 1;
+        shard_bits_ = 0;
+        while ( ( 1u << shard_bits_ ) < per_shard )
+        {
+            ++shard_bits_;
+        }
+        slots_ = std::vector<Slot>( ( size_t )per_shard * RATE_TABLE_SHARDS );
+    }
+
+    /**
+     * @brief 取出一个令牌
+     *
+     * @return true 允许 false 超过限制
+    */
+    bool acquire( std::string const& key )
+    {
+        auto hash = mix( std::hash<std::string>()( key ) );
+        auto now   = clock();
+        auto& slot = find( hash, now );
+
+        uint64_t state = slot.state.load( std::memory_order_relaxed );
+        while ( 1 )
+        {
+            uint32_t last   = ( uint32_t )( state >> 32 );
+            uint64_t tokens = ( last == 0 ) ? burst_milli_ : ( uint32_t )state; // 时间为0表示新的桶
+            uint32_t stamp  = now;
+            if ( last != 0 )
+            {
+                // 按无符号差值计算, 时钟回绕后仍然正确
+                // 上次时间略晚于当前时间是其他线程刚写入, 其余情况按经过的时间补充, 闲置很久的桶直接补满
+                uint32_t ahead = last - now;
+                if ( ahead > 0 && ahead < RATE_NEWER_WINDOW )
+                {
+                    stamp = last;
+                }
+                else
+                {
+                    uint32_t elapsed = now - last;
+                    tokens = ( uint64_t )std::min<double>( ( double )burst_milli_, ( double )tokens + elapsed * rate_milli_ );
+                }
+            }
+
+            bool allow = ( tokens >= 1000 );
+            if ( allow )
+            {
+                tokens -= 1000;
+            }
+
+            uint64_t next = ( ( uint64_t )stamp << 32 ) | ( uint32_t )tokens;
+            if ( slot.state.compare_exchange_weak( state, next, std::memory_order_relaxed ) )
+            {
+                return allow;
+            }
+        }
+    }
+
+PRIVATE: // type
+
+    struct Slot
+    {
+        Slot()
+            : key( 0 )
+            , state( 0 )
+        {}
+
+        Slot( Slot const& )
+            : key( 0 )
+            , state( 0 )
+        {}
+
+        std::atomic<uint64_t> key;    // key的哈希值 0 表示空槽
+        std::atomic<uint64_t> state;  // 高32位为最近使用时间(ms), 低32位为千分之一令牌数
+    };
+
+PRIVATE: // function
+
+    static uint64_t now_ms()
+    {
+        return ( uint64_t )std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    /**
+     * @brief 当前时间(ms), 32位回绕, 0保留给新的桶
+    */
+    uint32_t clock() const
+    {
+        auto now = ( uint32_t )( now_ms() - base_ms_ );
+        return now == 0 ? 1 : now;
+    }
+
+    static uint64_t mix( uint64_t v )
+    {
+        v += 0x9E3779B97F4A7C15ULL;
+        v = ( v ^ ( v >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+        v = ( v ^ ( v >> 27 ) ) * 0x94D049BB133111EBULL;
+        v ^= v >> 31;
+        return v == 0 ? 1 : v;
+    }
+
+    /**
+     * @brief 查找或占用key的槽
+    */
+    Slot& find( uint64_t hash, uint32_t now )
+    {
+        size_t shard = ( size_t )( hash >> 58 ) % RATE_TABLE_SHARDS;
+        size_t base  = shard << shard_bits_;
+        Slot* victim = nullptr;
+        uint32_t oldest = 0;
+        for ( uint32_t i = 0; i < RATE_TABLE_PROBE; ++i )
+        {
+            auto& slot = slots_[base + ( ( hash + i ) & shard_mask_ )];
+            uint64_t key = slot.key.load( std::memory_order_relaxed );
+            if ( key == hash )
+            {
+                return slot;
+            }
+
+            if ( key == 0 && slot.key.compare_exchange_strong( key, hash, std::memory_order_relaxed ) )
+            {
+                return slot;
+            }
+
+            if ( key == hash )
+            {
+                return slot; // 其他线程刚占用了该槽
+            }
+
+            auto last = ( uint32_t )( slot.state.load( std::memory_order_relaxed ) >> 32 );
+            uint32_t age = now - last;
+            if ( victim == nullptr || age > oldest )
+            {
+                oldest = age;
+                victim = &slot;
+            }
+        }
+
+        // 淘汰最久未使用的槽, 竞争失败时与胜者共用
+        uint64_t key = victim->key.load( std::memory_order_relaxed );
+        if ( victim->key.compare_exchange_strong( key, hash, std::memory_order_relaxed ) )
+        {
+            victim->state.store( 0, std::memory_order_relaxed );
+        }
+        return *victim;
+    }
+
+PRIVATE: // variable
+
+    double   rate_milli_;   // 每毫秒补充的千分之一令牌数, 数值上等于每秒的令牌数
+    uint64_t burst_milli_;
+    uint64_t base_ms_;
+    uint32_t shard_mask_;
+    uint32_t shard_bits_;
+    std::vector<Slot> slots_;
+};
+
+// 按key限速, 分别在接受连接, 请求解析后与websocket消息到达时检查
+class HttpRateLimiter
+{
+PUBLIC: // function
+
+    /**
+     * @brief 设置配置, 生成429回复
+    */
+    void set( HttpRateOpt const& opt, HttpConnKeyFunc const& conn_key, HttpReqKeyFunc const& req_key )
+    {
+        conn_key_ = conn_key;
+        req_key_  = req_key;
+        conn_.reset( opt.conn_rate > 0 ? new TokenTable( opt.conn_rate, opt.conn_burst, opt.capacity ) : nullptr );
+        req_.reset( opt.req_rate > 0 ? new TokenTable( opt.req_rate, opt.req_burst, opt.capacity ) : nullptr );
+        ws_.reset( opt.ws_rate > 0 ? new TokenTable( opt.ws_rate, opt.ws_burst, opt.capacity ) : nullptr );
+
+        std::stringstream ss;
+        ss << HTTP_VERSION << " " << eHttpRespCodeTooMany << " " << HTTP_MSG_TOO_MANY << HTTP_SEP
+           << "Retry-After: 1" << HTTP_SEP
+           << "Content-Length: 0" << HTTP_SEP
+           << "Connection: close" << HTTP_SEP << HTTP_SEP;
+        reject_ = ss.str();
+    }
+
+    /**
+     * @brief 连接的key, 未设置提取函数时为空
+    */
+    std::string conn_key( net::TcpClientSPtr const& client ) const
+    {
+        return conn_key_ ? conn_key_( client ) : std::string();
+    }
+
+    bool allow_conn( std::string const& key )
+    {
+        return conn_ == nullptr || key.empty() || conn_->acquire( key );
+    }
+
+    /**
+     * @brief 请求限速, 设置了请求key提取函数时使用其结果, 否则使用连接的key
+    */
+    bool allow_req( std::string const& key, HttpRequestSPtr const& req )
+    {
+        if ( req_ == nullptr )
+        {
+            return true;
+        }
+        auto real = req_key_ ? req_key_( req ) : key;
+        return real.empty() || req_->acquire( real );
+    }
+
+    bool allow_ws( std::string const& key )
+    {
+        return ws_ == nullptr || key.empty() || ws_->acquire( key );
+    }
+
+    /**
+     * @brief 预先生成的429回复
+    */
+    std::string const& reject() const
+    {
+        return reject_;
+    }
+
+PRIVATE: // variable
+
+    HttpConnKeyFunc conn_key_;
+    HttpReqKeyFunc req_key_;
+    std::unique_ptr<TokenTable> conn_;
+    std::unique_ptr<TokenTable> req_;
+    std::unique_ptr<TokenTable> ws_;
+    std::string reject_;
+};
+
+NAMESPACE_TARO_WS_END
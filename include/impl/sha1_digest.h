@@ -0,0 +1,174 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <cstring>
+#include <algorithm>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define SHA1_DIGEST_BYTES 20
+
+// SHA1摘要, 直接输出20字节的原始摘要, 全程不分配内存
+class Sha1Digest
+{
+PUBLIC: // function
+
+    Sha1Digest()
+        : total_( 0 )
+        , used_( 0 )
+    {
+        state_[0] = 0x67452301;
+        state_[1] = 0xEFCDAB89;
+        state_[2] = 0x98BADCFE;
+        state_[3] = 0x10325476;
+        state_[4] = 0xC3D2E1F0;
+    }
+
+    void update( uint8_t const* data, uint64_t bytes )
+    {
+        total_ += bytes;
+        if ( used_ > 0 )
+        {
+            uint32_t fill = ( uint32_t )std::min<uint64_t>( 64 - used_, bytes );
+            memcpy( block_ + used_, data, fill );
+            used_ += fill;
+            data  += fill;
+            bytes -= fill;
+            if ( used_ < 64 )
+            {
+                return;
+            }
+            transform( block_ );
+            used_ = 0;
+        }
+
+        for ( ; bytes >= 64; bytes -= 64, data += 64 )
+        {
+            transform( data );
+        }
+
+        memcpy( block_, data, ( size_t )bytes );
+        used_ = ( uint32_t )bytes;
+    }
+
+    void final( uint8_t* digest )
+    {
+        uint64_t bits = total_ * 8;
+        block_[used_++] = 0x80;
+        if ( used_ > 56 )
+        {
+            memset( block_ + used_, 0, 64 - used_ );
+            transform( block_ );
+            used_ = 0;
+        }
+        memset( block_ + used_, 0, 56 - used_ );
+        for ( int32_t i = 0; i < 8; ++i )
+        {
+            block_[56 + i] = ( uint8_t )( bits >> ( 56 - 8 * i ) );
+        }
+        transform( block_ );
+
+        for ( int32_t i = 0; i < 5; ++i )
+        {
+            digest[4 * i]     = ( uint8_t )( state_[i] >> 24 );
+            digest[4 * i + 1] = ( uint8_t )( state_[i] >> 16 );
+            digest[4 * i + 2] = ( uint8_t )( state_[i] >> 8 );
+            digest[4 * i + 3] = ( uint8_t )( state_[i] );
+        }
+    }
+
+PRIVATE: // function
+
+    static uint32_t rol( uint32_t v, uint32_t n )
+    {
+        return ( v << n ) | ( v >> ( 32 - n ) );
+    }
+
+    void transform( uint8_t const* block )
+    {
+        uint32_t w[80];
+        for ( int32_t i = 0; i < 16; ++i )
+        {
+            w[i] = ( ( uint32_t )block[4 * i] << 24 ) | ( ( uint32_t )block[4 * i + 1] << 16 )
+                 | ( ( uint32_t )block[4 * i + 2] << 8 ) | ( uint32_t )block[4 * i + 3];
+        }
+        for ( int32_t i = 16; i < 80; ++i )
+        {
+            w[i] = rol( w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1 );
+        }
+
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3], e = state_[4];
+        for ( int32_t i = 0; i < 80; ++i )
+        {
+            uint32_t f, k;
+            if ( i < 20 )
+                f = ( b & c ) | ( ~b & d ), k = 0x5A827999;
+            else if ( i < 40 )
+                f = b ^ c ^ d, k = 0x6ED9EBA1;
+            else if ( i < 60 )
+                f = ( b & c ) | ( b & d ) | ( c & d ), k = 0x8F1BBCDC;
+            else
+                f = b ^ c ^ d, k = 0xCA62C1D6;
+
+            uint32_t temp = rol( a, 5 ) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol( b, 30 );
+            b = a;
+            a = temp;
+        }
+
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+    }
+
+PRIVATE: // variable
+
+    uint32_t state_[5];
+    uint64_t total_;
+    uint32_t used_;
+    uint8_t  block_[64];
+};
+
+/**
+ * @brief base64编码到调用方提供的缓冲区
+ *
+ * @param[out] out 大小至少为 ( bytes + 2 ) / 3 * 4 + 1
+ * @return 编码后的长度
+*/
+inline uint32_t base64_encode( uint8_t const* in, uint32_t bytes, char* out )
+{
+    static const char* table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    char* p = out;
+    uint32_t i = 0;
+    for ( ; i + 3 <= bytes; i += 3 )
+    {
+        uint32_t v = ( ( uint32_t )in[i] << 16 ) | ( ( uint32_t )in[i + 1] << 8 ) | in[i + 2];
+        *p++ = table[( v >> 18 ) & 0x3F];
+        *p++ = table[( v >> 12 ) & 0x3F];
+        *p++ = table[( v >> 6 ) & 0x3F];
+        *p++ = table[v & 0x3F];
+    }
+
+    if ( i < bytes )
+    {
+        uint32_t v = ( uint32_t )in[i] << 16;
+        if ( i + 1 < bytes )
+        {
+            v |= ( uint32_t )in[i + 1] << 8;
+        }
+        *p++ = table[( v >> 18 ) & 0x3F];
+        *p++ = table[( v >> 12 ) & 0x3F];
+        *p++ = ( i + 1 < bytes ) ? table[( v >> 6 ) & 0x3F] : '=';
+        *p++ = '=';
+    }
+    *p = '\0';
+    return ( uint32_t )( p - out );
+}
+
+NAMESPACE_TARO_WS_END
@@ -0,0 +1,207 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#if defined( WS_USE_USDT )
+#include <sys/sdt.h>
+#define WS_USDT( name, conn, a, b ) DTRACE_PROBE3( co_ws, name, conn, a, b )
+#else
+#define WS_USDT( name, conn, a, b ) do {} while ( 0 )
+#endif
+
+/**
+ * @brief 跟踪点, 同时触发USDT探针与进程内的环形跟踪, 未编译USDT且未开启跟踪时只有一次原子读
+ *
+ * @param[in] name  USDT探针名 例如 perf probe sdt_co_ws:accept
+ * @param[in] event ETraceEvent
+ * @param[in] conn  连接ID
+ * @param[in] a,b   事件参数, 含义见ETraceEvent
+*/
+#define WS_PROBE( name, event, conn, a, b ) \
+    do \
+    { \
+        WS_USDT( name, conn, a, b ); \
+        if ( taro::ws::Tracer::enabled() ) \
+        { \
+            taro::ws::Tracer::instance().record( event, conn, ( uint64_t )( a ), ( uint64_t )( b ) ); \
+        } \
+    } while ( 0 )
+
+NAMESPACE_TARO_WS_BEGIN
+
+// 跟踪事件
+enum ETraceEvent
+{
+    eTraceAccept = 1,   // 接受连接
+    eTraceHeader,       // 请求头解析完成 a:数据体类型 b:Content-Length
+    eTraceRoute,        // 查找处理函数 a:1 找到 0 未找到
+    eTraceHandlerBegin, // 处理函数开始 a:数据体长度
+    eTraceHandlerEnd,   // 处理函数结束 a:返回值
+    eTraceFirstByte,    // 回复的第一次发送 a:字节数
+    eTraceWsRecv,       // 收到websocket帧 a:字节数 b:数据类型
+    eTraceWsSend,       // 发送websocket帧 a:字节数 b:操作码
+    eTraceClose,        // 连接关闭 a:请求数 b:接收的字节数
+};
+
+// 进程内的环形跟踪, 多个线程并发写入, 写满后覆盖最旧的事件, 按需导出最近的事件
+class Tracer
+{
+PUBLIC: // function
+
+    static Tracer& instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    static bool enabled()
+    {
+        return flag().load( std::memory_order_acquire );
+    }
+
+    /**
+     * @brief 分配连接ID, 从1开始
+    */
+    static uint64_t next_conn_id()
+    {
+        static std::atomic<uint64_t> id( 1 );
+        return id.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    /**
+     * @brief 开启或关闭跟踪, 缓冲只在首次开启时分配, 之后的容量不变
+     *
+     * @param[in] events 缓冲的事件数 0 表示关闭
+    */
+    void set( uint32_t events )
+    {
+        if ( events == 0 )
+        {
+            flag() = false;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if ( slots_.empty() )
+        {
+            uint32_t capacity = 1;
+            while ( capacity < events )
+            {
+                capacity <<= 1;
+            }
+            mask_  = capacity - 1;
+            slots_ = std::vector<Slot>( capacity );
+        }
+        flag() = true;
+    }
+
+    void record( uint32_t event, uint64_t conn, uint64_t a, uint64_t b )
+    {
+        uint64_t index = pos_.fetch_add( 1, std::memory_order_relaxed );
+        auto& slot = slots_[index & mask_];
+
+        // 写入期间序号为奇数, 导出时跳过正在写入或已被覆盖的事件
+        slot.seq.store( index * 2 + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        slot.ns.store( now_ns(), std::memory_order_relaxed );
+        slot.event.store( event, std::memory_order_relaxed );
+        slot.conn.store( conn, std::memory_order_relaxed );
+        slot.a.store( a, std::memory_order_relaxed );
+        slot.b.store( b, std::memory_order_relaxed );
+        slot.seq.store( index * 2 + 2, std::memory_order_release );
+    }
+
+    /**
+     * @brief 按发生顺序导出缓冲中的事件, 每行一个, 时间为相对第一个事件的微秒数
+    */
+    std::string dump() const
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if ( slots_.empty() )
+        {
+            return std::string();
+        }
+
+        uint64_t end   = pos_.load( std::memory_order_acquire );
+        uint64_t begin = ( end > slots_.size() ) ? end - slots_.size() : 0;
+        uint64_t base  = 0;
+        std::stringstream ss;
+        for ( uint64_t index = begin; index < end; ++index )
+        {
+            auto const& slot = slots_[index & mask_];
+            uint64_t seq = slot.seq.load( std::memory_order_acquire );
+            uint64_t ns  = slot.ns.load( std::memory_order_relaxed );
+            uint32_t event = slot.event.load( std::memory_order_relaxed );
+            uint64_t conn  = slot.conn.load( std::memory_order_relaxed );
+            uint64_t a     = slot.a.load( std::memory_order_relaxed );
+            uint64_t b     = slot.b.load( std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_acquire );
+            if ( seq != index * 2 + 2 || slot.seq.load( std::memory_order_relaxed ) != seq )
+            {
+                continue;
+            }
+
+            base = ( base == 0 ) ? ns : base;
+            ss << ( ns - base ) / 1000 << "us conn:" << conn << " " << name( event ) << " a:" << a << " b:" << b << "\n";
+        }
+        return ss.str();
+    }
+
+PRIVATE: // type
+
+    struct Slot
+    {
+        Slot()
+            : seq( 0 ), ns( 0 ), event( 0 ), conn( 0 ), a( 0 ), b( 0 )
+        {}
+
+        Slot( Slot const& )
+            : seq( 0 ), ns( 0 ), event( 0 ), conn( 0 ), a( 0 ), b( 0 )
+        {}
+
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> ns;
+        std::atomic<uint32_t> event;
+        std::atomic<uint64_t> conn;
+        std::atomic<uint64_t> a;
+        std::atomic<uint64_t> b;
+    };
+
+PRIVATE: // function
+
+    Tracer()
+        : pos_( 0 )
+        , mask_( 0 )
+    {}
+
+    static std::atomic<bool>& flag()
+    {
+        static std::atomic<bool> enabled( false );
+        return enabled;
+    }
+
+    static uint64_t now_ns()
+    {
+        return ( uint64_t )std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    static const char* name( uint32_t event )
+    {
+        static const char* names[] = { "unknown", "accept", "header", "route", "handler_begin", "handler_end", "first_byte", "ws_recv", "ws_send", "close" };
+        return event < sizeof( names ) / sizeof( names[0] ) ? names[event] : names[0];
+    }
+
+PRIVATE: // variable
+
+    mutable std::mutex mutex_;
+    std::atomic<uint64_t> pos_;
+    uint64_t mask_;
+    std::vector<Slot> slots_;
+};
+
+NAMESPACE_TARO_WS_END
@@ -0,0 +1,199 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <cstring>
+#include <algorithm>
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define WS_UTF8_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define WS_UTF8_BLOCK_BYTES 4096 // 解掩码与校验融合处理时的分块大小, 保证数据仍在L1缓存中
+
+// 增量式UTF-8校验, 码点可以跨越多次输入(websocket分片)
+// ASCII部分使用SIMD批量跳过, 多字节序列按照Unicode表3-7逐字节校验
+class Utf8Validator
+{
+PUBLIC: // function
+
+    Utf8Validator()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        need_  = 0;
+        lower_ = 0x80;
+        upper_ = 0xBF;
+    }
+
+    /**
+     * @brief 码点是否完整(消息结束时必须为true)
+    */
+    bool complete() const
+    {
+        return need_ == 0;
+    }
+
+    /**
+     * @brief 校验一段数据
+     *
+     * @return true 合法 false 非法
+    */
+    bool feed( uint8_t const* data, uint64_t bytes )
+    {
+        uint64_t i = 0;
+        while ( i < bytes )
+        {
+            if ( need_ == 0 )
+            {
+                i = skip_ascii( data, i, bytes );
+                if ( i >= bytes )
+                {
+                    break;
+                }
+            }
+
+            uint8_t c = data[i++];
+            if ( need_ > 0 )
+            {
+                if ( c < lower_ || c > upper_ )
+                {
+                    return false;
+                }
+                lower_ = 0x80;
+                upper_ = 0xBF;
+                --need_;
+                continue;
+            }
+
+            if ( c < 0x80 )
+                continue;
+            else if ( c >= 0xC2 && c <= 0xDF )
+                need_ = 1;
+            else if ( c == 0xE0 )
+                need_ = 2, lower_ = 0xA0;
+            else if ( c == 0xED )
+                need_ = 2, upper_ = 0x9F; // 排除代理区 U+D800..U+DFFF
+            else if ( c >= 0xE1 && c <= 0xEF )
+                need_ = 2;
+            else if ( c == 0xF0 )
+                need_ = 3, lower_ = 0x90;
+            else if ( c >= 0xF1 && c <= 0xF3 )
+                need_ = 3;
+            else if ( c == 0xF4 )
+                need_ = 3, upper_ = 0x8F; // 不超过 U+10FFFF
+            else
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 解掩码并校验, 按块处理使两次遍历共享缓存
+     *
+     * @param[in] mask 掩码 为nullptr时只做校验
+    */
+    bool unmask_feed( uint8_t* data, uint64_t bytes, uint8_t const* mask )
+    {
+        uint64_t offset = 0;
+        while ( offset < bytes )
+        {
+            uint64_t block = std::min<uint64_t>( WS_UTF8_BLOCK_BYTES, bytes - offset );
+            if ( nullptr != mask )
+            {
+                unmask( data + offset, block, mask, offset );
+            }
+            if ( !feed( data + offset, block ) )
+            {
+                return false;
+            }
+            offset += block;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 对数据解掩码
+     *
+     * @param[in] offset 数据在帧中的偏移, 用于确定掩码起始位置
+    */
+    static void unmask( uint8_t* data, uint64_t bytes, uint8_t const* mask, uint64_t offset = 0 )
+    {
+        uint8_t rotated[8];
+        for ( uint32_t i = 0; i < 8; ++i )
+        {
+            rotated[i] = mask[( offset + i ) & 3];
+        }
+
+        uint64_t word;
+        memcpy( &word, rotated, sizeof( word ) );
+
+        uint64_t i = 0;
+        for ( ; i + 8 <= bytes; i += 8 )
+        {
+            uint64_t v;
+            memcpy( &v, data + i, sizeof( v ) );
+            v ^= word;
+            memcpy( data + i, &v, sizeof( v ) );
+        }
+
+        for ( ; i < bytes; ++i )
+        {
+            data[i] ^= rotated[i & 7];
+        }
+    }
+
+PRIVATE: // function
+
+    /**
+     * @brief 跳过ASCII字符
+     *
+     * @return 第一个非ASCII字符的位置
+    */
+    static uint64_t skip_ascii( uint8_t const* data, uint64_t i, uint64_t bytes )
+    {
+#if defined( __AVX2__ )
+        for ( ; i + 32 <= bytes; i += 32 )
+        {
+            auto v = _mm256_loadu_si256( ( __m256i const* )( data + i ) );
+            if ( _mm256_movemask_epi8( v ) != 0 )
+                break;
+        }
+#elif defined( WS_UTF8_USE_SSE2 )
+        for ( ; i + 16 <= bytes; i += 16 )
+        {
+            auto v = _mm_loadu_si128( ( __m128i const* )( data + i ) );
+            if ( _mm_movemask_epi8( v ) != 0 )
+                break;
+        }
+#endif
+        for ( ; i + 8 <= bytes; i += 8 )
+        {
+            uint64_t v;
+            memcpy( &v, data + i, sizeof( v ) );
+            if ( v & 0x8080808080808080ULL )
+                break;
+        }
+
+        while ( i < bytes && data[i] < 0x80 )
+        {
+            ++i;
+        }
+        return i;
+    }
+
+PRIVATE: // variable
+
+    uint32_t need_;   // 当前码点还需要的后续字节数
+    uint8_t  lower_;  // 下一个后续字节的下限
+    uint8_t  upper_;  // 下一个后续字节的上限
+};
+
+NAMESPACE_TARO_WS_END
@@ -3,20 +3,75 @@
 
 #include "web_server.h"
 #include "impl/file_reader.h"
+#include "impl/work_pool.h"
+#include "impl/http_admission.h"
+#include "impl/rate_limiter.h"
+#include "impl/http_metrics.h"
+#include "impl/access_log.h"
 #include <map>
 #include <net/tcp_server.h>
+#include <base/utils/string_tool.h>
 
 NAMESPACE_TARO_WS_BEGIN
 
-using RoutineMap = std::map<std::string, WebServer::HttpRoutineHandler>;
+// 路径处理函数与配置
+struct HttpRoutine
+{
+    WebServer::HttpRoutineHandler handler;
+    WebServer::HttpBufferHandler buffer_handler; // 不为空时数据体缓存后交给该函数
+    HttpRoutineOpt opt;
+    std::shared_ptr<std::atomic<uint32_t>> inflight; // 该路径正在处理的请求数
+    std::shared_ptr<RouteMetrics> metrics;           // 该路径的指标, 未开启指标时为nullptr
+};
+
+using RoutineMap = std::map<std::string, HttpRoutine>;
 
 struct WebServerImpl
 {
+    WebServerImpl()
+        : hb_interval_( 0 )
+        , hb_max_missed_( 0 )
+        , decode_( true )
+        , decode_limit_( HTTP_DECODE_MAX_BYTES )
+        , compress_( false )
+    {}
+
+    void add_routine( const char* url, HttpRoutine routine )
+    {
+        routine.inflight = std::make_shared<std::atomic<uint32_t>>( 0 );
+        if ( metrics_ != nullptr )
+        {
+            routine.metrics = std::make_shared<RouteMetrics>();
+        }
+        if ( routine.opt.offload && pool_ == nullptr )
+        {
+            pool_.reset( new WorkPool( std::max<uint32_t>( std::thread::hardware_concurrency(), 1 ) ) );
+        }
+
+        if( is_wildcard( url ) )
+        {
+            wildcard_routine_[url] = routine;
+            return;
+        }
+        matched_routine_[url] = routine;
+    }
+
+    uint32_t hb_interval_;
+    uint32_t hb_max_missed_;
+    bool decode_;           // 是否解压请求数据体
+    uint64_t decode_limit_; // 解压后的数据体上限
+    bool compress_;         // 是否压缩回复
+    HttpCompressOpt compress_opt_;
     RoutineMap matched_routine_;
     RoutineMap wildcard_routine_;
     net::TcpServerSPtr svr_;
     WebServer::WebsocketHandler ws_handler_;
     std::unique_ptr<FileReader> file_reader_;
+    std::unique_ptr<WorkPool> pool_;  // 处理函数卸载的线程池
+    HttpAdmission admit_;
+    HttpRateLimiter limiter_;
+    std::unique_ptr<HttpMetrics> metrics_; // nullptr 表示不记录指标
+    std::unique_ptr<AccessLog> access_log_; // nullptr 表示不记录访问日志
 };
 
 NAMESPACE_TARO_WS_END
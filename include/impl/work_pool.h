@@ -0,0 +1,227 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define WORK_POOL_IDLE_MS 10 // 工作线程无任务时的休眠间隔(ms)
+
+// 任务窃取线程池, 每个线程一个队列, 自己的队列为空时从其他队列尾部窃取
+class WorkPool
+{
+PUBLIC: // type
+
+    using Task = std::function< void() >;
+
+PUBLIC: // function
+
+    explicit WorkPool( uint32_t threads )
+        : next_( 0 )
+        , stop_( false )
+        , depth_( 0 )
+        , executed_( 0 )
+        , wait_us_total_( 0 )
+        , wait_us_max_( 0 )
+    {
+        TARO_ASSERT( threads > 0 );
+        for ( uint32_t i = 0; i < threads; ++i )
+        {
+            queues_.emplace_back( new Queue );
+        }
+        for ( uint32_t i = 0; i < threads; ++i )
+        {
+            threads_.emplace_back( &WorkPool::run, this, i );
+        }
+    }
+
+    ~WorkPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( idle_mutex_ );
+            stop_ = true;
+        }
+        idle_cv_.notify_all();
+        for ( auto& one : threads_ )
+        {
+            one.join();
+        }
+    }
+
+    /**
+     * @brief 提交任务, 按轮转放入各线程的队列
+     *        计数在休眠锁内增加, 刚检查完条件准备休眠的线程不会错过通知
+    */
+    void submit( Task const& task )
+    {
+        auto& queue = *queues_[next_++ % queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock( queue.mutex );
+            queue.items.push_back( Item{ task, now_us() } );
+        }
+        {
+            std::lock_guard<std::mutex> lock( idle_mutex_ );
+            ++depth_;
+        }
+        idle_cv_.notify_one();
+    }
+
+    uint32_t threads() const
+    {
+        return ( uint32_t )threads_.size();
+    }
+
+    /**
+     * @brief 排队中的任务数
+    */
+    uint32_t depth() const
+    {
+        return ( uint32_t )std::max<int64_t>( depth_.load(), 0 );
+    }
+
+    /**
+     * @brief 已执行的任务数
+    */
+    uint64_t executed() const
+    {
+        return executed_;
+    }
+
+    /**
+     * @brief 任务排队时间的总和与最大值(us)
+    */
+    uint64_t wait_us_total() const
+    {
+        return wait_us_total_;
+    }
+
+    uint64_t wait_us_max() const
+    {
+        return wait_us_max_;
+    }
+
+PRIVATE: // type
+
+    struct Item
+    {
+        Task     task;
+        uint64_t enqueue_us;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Item> items;
+    };
+
+PRIVATE: // function
+
+    static uint64_t now_us()
+    {
+        return ( uint64_t )std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    /**
+     * @brief 取出任务, 先取自己队列的头部, 再窃取其他队列的尾部
+     *        窃取先不阻塞地尝试一轮, 未取到时再逐个加锁检查, 有任务排队时不会进入休眠
+    */
+    bool take( uint32_t index, Item& item )
+    {
+        {
+            auto& own = *queues_[index];
+            std::lock_guard<std::mutex> lock( own.mutex );
+            if ( !own.items.empty() )
+            {
+                item = std::move( own.items.front() );
+                own.items.pop_front();
+                --depth_;
+                return true;
+            }
+        }
+
+        for ( bool block : { false, true } )
+        {
+            for ( size_t i = 1; i < queues_.size(); ++i )
+            {
+                if ( steal( *queues_[( index + i ) % queues_.size()], item, block ) )
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 从其他队列的尾部窃取任务, 计数与出队在同一把锁内, 计数大于0时必有任务
+    */
+    bool steal( Queue& queue, Item& item, bool block )
+    {
+        std::unique_lock<std::mutex> lock( queue.mutex, std::defer_lock );
+        if ( block )
+        {
+            lock.lock();
+        }
+        else if ( !lock.try_lock() )
+        {
+            return false;
+        }
+
+        if ( queue.items.empty() )
+        {
+            return false;
+        }
+        item = std::move( queue.items.back() );
+        queue.items.pop_back();
+        --depth_;
+        return true;
+    }
+
+    void run( uint32_t index )
+    {
+        while ( !stop_ )
+        {
+            Item item;
+            if ( !take( index, item ) )
+            {
+                std::unique_lock<std::mutex> lock( idle_mutex_ );
+                idle_cv_.wait_for( lock, std::chrono::milliseconds( WORK_POOL_IDLE_MS ), [this]()
+                {
+                    return stop_ || depth_ > 0;
+                } );
+                continue;
+            }
+
+            uint64_t wait = now_us() - item.enqueue_us;
+            wait_us_total_ += wait;
+            uint64_t max = wait_us_max_;
+            while ( wait > max && !wait_us_max_.compare_exchange_weak( max, wait ) );
+
+            item.task();
+            ++executed_;
+        }
+    }
+
+PRIVATE: // variable
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<uint32_t> next_;
+    std::atomic<bool> stop_;
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    std::atomic<int64_t> depth_;
+    std::atomic<uint64_t> executed_;
+    std::atomic<uint64_t> wait_us_total_;
+    std::atomic<uint64_t> wait_us_max_;
+};
+
+NAMESPACE_TARO_WS_END
@@ -3,38 +3,48 @@
 
 #include "ws_client.h"
 #include "ws_proto.h"
+#include "ws_heartbeat.h"
+#include "deadline.h"
 #include <net/tcp_client.h>
 
 NAMESPACE_TARO_WS_BEGIN
 
 #define RET_CHECK( ret ) if( ret < 0 ) return ret;
+#define FRAME_CHECK( ret ) if( ret < 0 ) { if ( ret == TARO_ERR_TIMEOUT ) poison( session ); return ret; }
 
 struct WsClientImpl
 {
     WsClientImpl()
         : active_( true )
+        , hb_interval_( 0 )
+        , hb_max_missed_( 0 )
     {}
 
-    static WsClientSPtr create( net::TcpClientSPtr const& cli )
+    static WsClientSPtr create( WsSessionSPtr const& session )
     {
         auto client = std::make_shared<WsClient>();
-        client->impl_->active_ = false;
-        client->impl_->client_ = cli;
+        client->impl_->active_  = false;
+        client->impl_->session_ = session;
         return client;
     }
 
     /**
     * @brief 接收数据的逻辑，是整个库的核心逻辑之一
     */
-    static int32_t recv_ws( net::TcpClientSPtr const& client, DynPacketSPtr& out, bool& last, EWsDataKind& kind, EWsEvent& evt )
+    static int32_t recv_ws( WsSession& session, DynPacketSPtr& out, bool& last, EWsDataKind& kind, EWsEvent& evt, Deadline const& dl = Deadline() )
     {
         uint32_t header_bytes = 0;
         uint64_t data_bytes   = 0;
         char read_buf[WS_MAX_HEAD_BYTES] = { 0 };
         while( 1 )
         {
-            // 接收数据头
-            auto ret = recv_msg( client, read_buf, WS_COMMON_HEAD_BYTES );
+            // 接收数据头, 尚未收到任何数据时超时不影响连接
+            uint32_t got = 0;
+            auto ret = recv_part( session, read_buf, WS_COMMON_HEAD_BYTES, dl, &got );
+            if ( ret == TARO_ERR_TIMEOUT && ( got > 0 || session.dead_ ) )
+            {
+                poison( session );
+            }
             RET_CHECK( ret );
 
             uint8_t* buffer = ( uint8_t* )read_buf;
@@ -43,101 +53,318 @@ struct WsClientImpl
             header_bytes = WS_COMMON_HEAD_BYTES;
             if ( len == 126 )
             {
-                ret = recv_msg( client, read_buf + WS_COMMON_HEAD_BYTES, 2 );
-                RET_CHECK( ret );
+                ret = recv_part( session, read_buf + WS_COMMON_HEAD_BYTES, 2, dl );
+                FRAME_CHECK( ret );
                 uint16_t* pl = ( uint16_t* )( read_buf + WS_COMMON_HEAD_BYTES );
                 data_bytes = ( uint64_t )ntohs( *pl );
                 header_bytes += 2;
             }
             else if( len == 127 )
             {
-                ret = recv_msg( client, read_buf + WS_COMMON_HEAD_BYTES, 8 );
-                RET_CHECK( ret );
+                ret = recv_part( session, read_buf + WS_COMMON_HEAD_BYTES, 8, dl );
+                FRAME_CHECK( ret );
                 uint64_t* pl = ( uint64_t* )( read_buf + WS_COMMON_HEAD_BYTES );
                 data_bytes = ntohll( *pl );
                 header_bytes += 8;
             }
 
             // 接收数据
-            char mask[4] = { 0 };
+            uint8_t mask[4] = { 0 };
             uint32_t mask_bytes = ( ( buffer[1] & WS_MASK_ENABLE_BIT ) ? 4 : 0 );
             if ( mask_bytes > 0 )
             {
-                ret = recv_msg( client, mask, mask_bytes );
-                RET_CHECK( ret );
+                ret = recv_part( session, ( char* )mask, mask_bytes, dl );
+                FRAME_CHECK( ret );
             }
 
-            auto packet = create_default_packet( ( uint32_t )data_bytes );
-            ret = recv_msg( client, ( char* )packet->buffer(), ( uint32_t )data_bytes );
-            RET_CHECK( ret );
-            packet->resize( ( uint32_t )data_bytes );
-
-            if ( mask_bytes > 0 )
+            if ( data_bytes > UINT32_MAX )
             {
-                uint8_t* data = ( uint8_t* )packet->buffer();
-                for ( uint64_t i = 0; i < data_bytes; ++i )
-                    data[i] = ( char )( data[i] ^ mask[i % 4] );
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "frame too large:" << data_bytes;
+                return TARO_ERR_FORMAT;
             }
 
+            auto packet = create_default_packet( ( uint32_t )data_bytes );
+            ret = recv_part( session, ( char* )packet->buffer(), ( uint32_t )data_bytes, dl );
+            FRAME_CHECK( ret );
+            packet->resize( ( uint32_t )data_bytes );
+
             auto opcode = ( buffer[0] & WS_OP_CODE_BITS );
+            bool fin    = ( buffer[0] & WS_FIN_BIT ) != 0;
             evt  = eWsEventMsg;
             kind = eWsDataKindInvalid;
+            if ( ( opcode == WS_OP_CONTENT_TEXT || opcode == WS_OP_CONTENT_BINARY ) && session.recv_kind_ != eWsDataKindInvalid )
+            {
+                return protocol_error( session, "new message while a fragmented message is open" );
+            }
+            else if ( opcode == WS_OP_CODE_CONTINUE && session.recv_kind_ == eWsDataKindInvalid )
+            {
+                return protocol_error( session, "continuation frame without an open message" );
+            }
+
             if ( opcode == WS_OP_CONTENT_TEXT )
+            {
                 kind = eWsDataKindText;
+                session.utf8_.reset();
+            }
             else if ( opcode == WS_OP_CONTENT_BINARY )
                 kind = eWsDataKindBinary;
-            else if ( opcode == WS_OP_CODE_CLOSE )
+            else if( opcode == WS_OP_CODE_CONTINUE )
+            {
+                /*
+                一个分片的消息由起始帧（FIN为0，opcode非0），
+                若干（0个或多个）帧（FIN为0，opcode为0），
+                结束帧（FIN为1，opcode为0）。
+                */
+                kind = session.recv_kind_;
+            }
+            else if ( opcode < WS_OP_CODE_CLOSE )
+            {
+                return TARO_ERR_FORMAT;
+            }
+
+            // 文本消息在解掩码的同时校验UTF-8, 码点可以跨越分片
+            uint8_t* data = ( uint8_t* )packet->buffer();
+            if ( kind == eWsDataKindText )
+            {
+                if ( !session.utf8_.unmask_feed( data, data_bytes, mask_bytes > 0 ? mask : nullptr )
+                  || ( fin && !session.utf8_.complete() ) )
+                {
+                    WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "text message is not valid utf-8";
+                    auto close_pack = WsProto::create_close_packet( WS_CLOSE_INVALID_DATA, session.use_mask_ );
+                    session.send_ctrl( close_pack );
+                    return TARO_ERR_FORMAT;
+                }
+            }
+            else if ( mask_bytes > 0 )
+            {
+                Utf8Validator::unmask( data, data_bytes, mask );
+            }
+
+            if ( opcode == WS_OP_CODE_CLOSE )
                 evt = eWsEventClose;
             else if( opcode == WS_OP_CODE_PING )
             {
-                auto resp_pack = WsProto::create_pong_packet( ( uint8_t* )packet->buffer(), ( uint32_t )data_bytes );
-                client->send( ( char* )resp_pack->buffer(), resp_pack->size() );
+                auto resp_pack = WsProto::create_pong_packet( data, ( uint32_t )data_bytes, session.use_mask_ );
+                session.send_ctrl( resp_pack );
                 continue;
             }
             else if( opcode == WS_OP_CODE_PONG )
             {
+                WsHeartbeat::on_pong( session, data, data_bytes );
                 continue;
             }
-            else if( opcode == WS_OP_CODE_CONTINUE )
+            else if ( opcode >= WS_OP_CODE_CLOSE )
             {
-                /*
-                一个分片的消息由起始帧（FIN为0，opcode非0），
-                若干（0个或多个）帧（FIN为0，opcode为0），
-                结束帧（FIN为1，opcode为0）。
-                */
+                return TARO_ERR_FORMAT;
             }
-            else
+
+            if ( opcode != WS_OP_CODE_CLOSE )
             {
-                return TARO_ERR_FORMAT;
+                session.recv_kind_ = fin ? eWsDataKindInvalid : kind;
             }
 
             out = packet;
-            last = ( buffer[0] & WS_FIN_BIT );
+            last = fin;
             return TARO_OK;
         }
     }
 
-    static int32_t recv_msg( net::TcpClientSPtr const& cli, char* buf, uint32_t bytes )
+    /**
+    * @brief 发送内存数据, 逐个分片组帧发送, 内存占用不超过一个分片
+    */
+    static bool send_buffer( WsSession& session, uint8_t* buf, uint64_t bytes, uint8_t type, bool use_mask, bool urgent )
+    {
+        WsSendGuard guard( session, urgent );
+
+        uint64_t offset = 0;
+        do
+        {
+            uint64_t len = std::min<uint64_t>( bytes - offset, session.frag_bytes_ );
+            bool fin     = ( offset + len == bytes );
+            auto begin   = SystemTime::current_ms();
+            auto opcode  = ( offset == 0 ) ? type : WS_OP_CODE_CONTINUE;
+            auto frame   = WsProto::create_single_packet( buf + offset, len, opcode, fin, use_mask );
+            if ( session.client_->send( ( char* )frame->buffer(), frame->size() ) < 0 )
+            {
+                return false;
+            }
+            WS_PROBE( ws_send, eTraceWsSend, session.conn_id_, len, opcode );
+            offset += len;
+
+            if ( !fin )
+            {
+                session.adapt_frag( ( uint32_t )len, SystemTime::current_ms() - begin );
+                if ( !session.flush_ctrl() )
+                {
+                    return false;
+                }
+            }
+        } while ( offset < bytes );
+        return true;
+    }
+
+    /**
+    * @brief 流式发送, 预读一个分片以确定结束帧, 内存占用固定为两个分片
+    */
+    static bool send_stream( WsSession& session, WsPullFunc const& pull, uint8_t type, bool use_mask )
     {
-        while( 1 )
+        WsSendGuard guard( session, false );
+
+        DynPacketSPtr bufs[2] =
         {
-            auto ret = cli->recv( buf, bytes );
+            create_default_packet( WS_MAX_FRAG_SIZE + WS_MAX_HEAD_BYTES ),
+            create_default_packet( WS_MAX_FRAG_SIZE + WS_MAX_HEAD_BYTES ),
+        };
+
+        // 数据从WS_MAX_HEAD_BYTES处开始存放, 帧头直接写在数据前面
+        auto payload = []( DynPacketSPtr const& pkt ) { return ( uint8_t* )pkt->buffer() + WS_MAX_HEAD_BYTES; };
+        auto pull_one = [&]( DynPacketSPtr const& pkt ) -> int64_t
+        {
+            auto ret = pull( payload( pkt ), session.frag_bytes_ );
+            return ( ret > session.frag_bytes_ ) ? TARO_ERR_INVALID_ARG : ret;
+        };
+
+        uint32_t idx   = 0;
+        uint8_t opcode = type;
+        int64_t cur    = pull_one( bufs[idx] );
+        while ( 1 )
+        {
+            int64_t next = ( cur > 0 ) ? pull_one( bufs[idx ^ 1] ) : 0;
+            if ( cur < 0 || next < 0 )
+            {
+                WS_ERROR << "pull stream data failed";
+                return false;
+            }
+
+            bool fin   = ( next == 0 );
+            auto begin = SystemTime::current_ms();
+            if ( !send_frame( session, payload( bufs[idx] ), ( uint64_t )cur, opcode, fin, use_mask ) )
+            {
+                return false;
+            }
+
+            if ( fin )
+            {
+                return true;
+            }
+
+            session.adapt_frag( ( uint32_t )cur, SystemTime::current_ms() - begin );
+            if ( !session.flush_ctrl() )
+            {
+                return false;
+            }
+            opcode = WS_OP_CODE_CONTINUE;
+            idx   ^= 1;
+            cur    = next;
+        }
+    }
+
+    /**
+    * @brief 发送一帧, 帧头写入payload之前预留的空间
+    */
+    static bool send_frame( WsSession& session, uint8_t* payload, uint64_t bytes, uint8_t type, bool fin, bool use_mask )
+    {
+        uint8_t mask[4] = { 0 };
+        if ( use_mask )
+        {
+            WsProto::create_mask( mask );
+            WsProto::mask_data( payload, bytes, mask );
+        }
+
+        auto head_len  = WsProto::header_bytes( bytes, use_mask );
+        uint8_t* frame = payload - head_len;
+        WsProto::create_header( frame, bytes, type, fin, use_mask ? mask : nullptr );
+        WS_PROBE( ws_send, eTraceWsSend, session.conn_id_, bytes, type );
+        return session.client_->send( ( char* )frame, ( uint32_t )( head_len + bytes ) ) >= 0;
+    }
+
+    /**
+    * @brief 接收帧内指定长度的数据, 开启心跳时每个心跳间隔醒来一次, 检查连接是否已被心跳判定失效,
+    *        帧头、长度、掩码、负载都经过这里, 对端发送半帧后沉默同样能被发现,
+    *        失效的连接由调用方在接收协程中关闭, 避免心跳协程与接收协程同时操作连接
+    * 
+    * @param[out] got 已接收的字节数 可以为nullptr
+    */
+    static int32_t recv_part( WsSession& session, char* buf, uint32_t bytes, Deadline const& dl, uint32_t* got = nullptr )
+    {
+        uint32_t offset = 0;
+        while ( 1 )
+        {
+            uint32_t part = 0;
+            auto ret = recv_msg( session.client_, buf + offset, bytes - offset, dl.sooner( session.hb_interval_ ), &part );
+            offset += part;
+            if ( got != nullptr )
+            {
+                *got = offset;
+            }
+
+            if ( ret != TARO_ERR_TIMEOUT || dl.expired() || session.dead_ )
+            {
+                return ret;
+            }
+        }
+    }
+
+    /**
+    * @brief 接收指定长度的数据, 超过截止时间返回TARO_ERR_TIMEOUT
+    * 
+    * @param[out] got 已接收的字节数 可以为nullptr
+    */
+    static int32_t recv_msg( net::TcpClientSPtr const& cli, char* buf, uint32_t bytes, Deadline const& dl, uint32_t* got = nullptr )
+    {
+        uint32_t offset = 0;
+        while( offset < bytes )
+        {
+            auto ret = cli->recv( buf + offset, bytes - offset, dl.remain() );
+            if ( ret == TARO_ERR_TIMEOUT || ( ret <= 0 && dl.expired() ) )
+            {
+                ret = TARO_ERR_TIMEOUT;
+            }
+
             if ( ret < 0 )
             {
                 if ( ret == TARO_ERR_CONTINUE )
                     continue;
                 return ret;
             }
-            if ( ret < ( int32_t )bytes )
-                continue;
-            break;
+            offset += ( uint32_t )ret;
+            if ( got != nullptr )
+            {
+                *got = offset;
+            }
         }
         return TARO_OK;
     }
 
+    /**
+    * @brief 违反协议时发送1002关闭帧, 连接由调用方关闭
+    */
+    static int32_t protocol_error( WsSession& session, const char* reason )
+    {
+        WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "websocket protocol error:" << reason;
+        auto close_pack = WsProto::create_close_packet( WS_CLOSE_PROTOCOL_ERROR, session.use_mask_ );
+        session.send_ctrl( close_pack );
+        return TARO_ERR_FORMAT;
+    }
+
+    /**
+    * @brief 帧接收到一半时超时或连接已被心跳判定失效, 连接上的数据已无法对齐, 关闭连接
+    */
+    static void poison( WsSession& session )
+    {
+        if ( session.dead_ )
+            WS_ERROR << "heartbeat lost, close connection";
+        else
+            WS_ERROR << "receive frame timeout, close connection";
+        session.dead_ = true;
+        session.client_->close();
+    }
+
     bool active_;
+    uint32_t hb_interval_;
+    uint32_t hb_max_missed_;
     std::string check_str_;
-    net::TcpClientSPtr client_;
+    WsSessionSPtr session_;
 };
 
 NAMESPACE_TARO_WS_END
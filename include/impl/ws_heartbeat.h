@@ -0,0 +1,159 @@
+﻿
+#pragma once
+
+#include "impl/ws_proto.h"
+#include "impl/ws_session.h"
+#include <co_routine/inc.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define WS_HEARTBEAT_PAYLOAD_BYTES 8     // ping数据体为发送时间戳
+#define WS_HEARTBEAT_MIN_WAIT      10
+#define WS_HEARTBEAT_MAX_WAIT      1000
+#define WS_HEARTBEAT_SEND_MS       1000  // ping的发送超时, 超时视为连接失效
+
+// websocket心跳管理, 所有连接共用一个定时器队列和一个协程
+class WsHeartbeat
+{
+PUBLIC: // function
+
+    static WsHeartbeat& instance()
+    {
+        static WsHeartbeat inst;
+        return inst;
+    }
+
+    /**
+     * @brief 注册连接, 连接释放后自动移除
+    */
+    void add( WsSessionSPtr const& session )
+    {
+        TARO_ASSERT( session && session->hb_interval_ > 0 );
+
+        std::lock_guard<std::mutex> lock( mutex_ );
+        timers_.emplace( now_ms() + session->hb_interval_, session );
+        if ( !running_ )
+        {
+            running_ = true;
+            co_run std::bind( &WsHeartbeat::run, this ), opt_name( "ws_heartbeat" );
+        }
+    }
+
+    /**
+     * @brief 收到pong, 根据数据体中的时间戳计算往返时延
+    */
+    static void on_pong( WsSession& session, uint8_t const* buf, uint64_t bytes )
+    {
+        if ( bytes != WS_HEARTBEAT_PAYLOAD_BYTES )
+        {
+            return; // 非心跳产生的pong
+        }
+
+        uint64_t sent = 0;
+        memcpy( &sent, buf, sizeof( sent ) );
+        sent = ntohll( sent );
+
+        auto now = now_ms();
+        if ( sent <= now )
+        {
+            session.rtt_ms_ = ( int32_t )( now - sent );
+        }
+        session.hb_missed_  = 0;
+        session.hb_waiting_ = false;
+    }
+
+PRIVATE: // function
+
+    WsHeartbeat()
+        : running_( false )
+    {
+
+    }
+
+    static uint64_t now_ms()
+    {
+        return ( uint64_t )SystemTime::current_ms();
+    }
+
+    void run()
+    {
+        std::vector<std::weak_ptr<WsSession>> expired;
+        while( 1 )
+        {
+            auto now = now_ms();
+            expired.clear();
+            {
+                std::lock_guard<std::mutex> lock( mutex_ );
+                auto end = timers_.upper_bound( now );
+                for ( auto it = timers_.begin(); it != end; ++it )
+                {
+                    expired.emplace_back( it->second );
+                }
+                timers_.erase( timers_.begin(), end );
+            }
+
+            for ( auto const& one : expired )
+            {
+                auto session = one.lock();
+                if ( session == nullptr || session->dead_ )
+                {
+                    continue; // 连接已释放
+                }
+                check( session, now );
+            }
+
+            uint64_t wait = WS_HEARTBEAT_MAX_WAIT;
+            {
+                std::lock_guard<std::mutex> lock( mutex_ );
+                if ( !timers_.empty() )
+                {
+                    auto next = timers_.begin()->first;
+                    wait = ( next > now ) ? next - now : 0;
+                }
+            }
+            wait = std::max<uint64_t>( WS_HEARTBEAT_MIN_WAIT, std::min<uint64_t>( wait, WS_HEARTBEAT_MAX_WAIT ) );
+            rt::co_wait( ( uint32_t )wait );
+        }
+    }
+
+    void check( WsSessionSPtr const& session, uint64_t now )
+    {
+        if ( session->hb_waiting_ && ++session->hb_missed_ >= session->hb_max_missed_ )
+        {
+            // 只做标记, 由连接的接收协程关闭连接并通知, 心跳协程不触碰连接上正在进行的收发
+            WS_WARN << "websocket heartbeat timeout, missed:" << session->hb_missed_;
+            session->dead_ = true;
+            return;
+        }
+
+        uint64_t stamp = htonll( now );
+        auto ping = WsProto::create_ping_packet( ( uint8_t* )&stamp, sizeof( stamp ), session->use_mask_ );
+        session->hb_waiting_ = true;
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            timers_.emplace( now + session->hb_interval_, session );
+        }
+
+        // 在独立的协程中限时发送, 一个发送窗口已满的对端不会拖住其他连接的心跳
+        // 超时的ping可能已部分写入, 连接上的数据无法再对齐, 直接判定失效
+        co_run [session, ping]()
+        {
+            if ( !session->send_ctrl( ping, WS_HEARTBEAT_SEND_MS ) )
+            {
+                WS_WARN << "websocket heartbeat send failed";
+                session->dead_ = true;
+            }
+        }, opt_name( "ws_ping" );
+    }
+
+PRIVATE: // variable
+
+    bool        running_;
+    std::mutex  mutex_;
+    std::multimap<uint64_t, std::weak_ptr<WsSession>> timers_;
+};
+
+NAMESPACE_TARO_WS_END
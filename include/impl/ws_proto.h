@@ -1,9 +1,10 @@
 ﻿
 #pragma once
 
-#include <base/utils/base64.h>
-#include <base/utils/sha1.h>
 #include "impl/http_proto_impl.h"
+#include "impl/sha1_digest.h"
+#include "impl/ws_random.h"
+#include "impl/utf8_validator.h"
 #if defined( _WIN32 ) || defined( _WIN64 )
 #include<Winsock2.h>
 #else
@@ -39,7 +40,10 @@ len之后的4个字节当 mask = 1时为mask字节
 
 #define WS_MIN_PACKET_SIZE     125
 #define WS_MID_PACKET_SIZE     0xFFFF
-#define WS_SPLICE_PACKET_SIZE  0x20000
+#define WS_SPLICE_PACKET_SIZE  0x20000  // 初始分片大小
+#define WS_MIN_FRAG_SIZE       0x4000   // 自适应分片的下限
+#define WS_MAX_FRAG_SIZE       0x80000  // 自适应分片的上限
+#define WS_FRAG_TARGET_MS      8        // 单个分片占用连接的目标时长
 
 #define WS_OP_CODE_CONTINUE  0
 #define WS_OP_CONTENT_TEXT   1
@@ -48,40 +52,20 @@ len之后的4个字节当 mask = 1时为mask字节
 #define WS_OP_CODE_PING      9
 #define WS_OP_CODE_PONG      10
 
-inline std::string random_str( uint32_t len )
-{
-    ::srand( ( uint32_t )SystemTime::current_ms() );
-
-    std::stringstream ss;
-    for( uint32_t i = 0; i < len; ++i )
-    {
-        auto temp = ( uint8_t )( rand() % 256 );
-        if( temp == 0 )
-        {
-            temp = 128;
-        }
-        ss << temp;
-    }
-    return ss.str();
-}
-
-inline std::string hex_to_str( std::string const& str )
-{
-    std::string ret;
-    std::stringstream ss;
-    for( uint32_t i = 0; i < str.size(); ++i )
-    {
-        ss << std::hex << str[i];
-        uint32_t temp;
-        if( ( i & 1 ) == 1 )
-        {
-            ss >> temp;
-            ss.clear();
-            ret.push_back( char( temp ) );
-        }
-    }
-    return ret;
-}
+#define WS_CLOSE_NORMAL         1000
+#define WS_CLOSE_PROTOCOL_ERROR 1002 // 违反协议, 如分片消息的帧顺序错误
+#define WS_CLOSE_INVALID_DATA   1007 // 数据与消息类型不符, 如文本消息不是合法的UTF-8
+
+#define WS_KEY_GUID            "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_GUID_LEN        36
+#define WS_ACCEPT_KEY_BYTES    28   // base64( sha1 ) 的长度
+#define WS_NONCE_BYTES         16   // Sec-WebSocket-Key 随机数的长度
+#define WS_ACCEPT_RESP_PREFIX  "HTTP/1.1 101 Switching protocols\r\n" \
+                               "Server: taro/1.1\r\n"                   \
+                               "Upgrade: websocket\r\n"                 \
+                               "Connection: upgrade\r\n"                \
+                               "Sec-WebSocket-Accept: "
+#define WS_ACCEPT_RESP_BYTES   ( sizeof( WS_ACCEPT_RESP_PREFIX ) - 1 + WS_ACCEPT_KEY_BYTES + 4 )
 
 class WsProto
 {
@@ -89,7 +73,11 @@ PUBLIC:
 
     static HttpRequest create_open_packet( std::string const& host, std::string const& url, std::string& random_code )
     {
-        random_code = "s1T+MTWvpL8NJCu0N0mX1Q==";
+        // 每次握手使用新的16字节随机数
+        uint8_t nonce[WS_NONCE_BYTES];
+        char nonce_str[( WS_NONCE_BYTES + 2 ) / 3 * 4 + 1];
+        FastRandom::local().fill( nonce, WS_NONCE_BYTES );
+        random_code.assign( nonce_str, base64_encode( nonce, WS_NONCE_BYTES, nonce_str ) );
 
         HttpRequest req( "GET", url.c_str() );
         req.set( "Upgrade",                  "websocket" );
@@ -110,125 +98,150 @@ PUBLIC:
         return create_single_packet( buf, bytes, WS_OP_CODE_PONG, true, use_mask );
     }
 
-    static std::list<DynPacketSPtr> split_packet( uint8_t* buf, uint64_t bytes, uint8_t type, bool use_mask = false )
+    static DynPacketSPtr create_close_packet( uint16_t code, bool use_mask = true )
     {
-        std::list<DynPacketSPtr> packetlist;
-        if ( nullptr == buf || 0 == bytes )
-        {
-            WS_ERROR << "packet is empty.";
-            return packetlist;
-        }
+        uint16_t status = htons( code );
+        return create_single_packet( ( uint8_t* )&status, sizeof( status ), WS_OP_CODE_CLOSE, true, use_mask );
+    }
 
-        if ( bytes <= WS_SPLICE_PACKET_SIZE )
-        {
-            packetlist.emplace_back( create_single_packet( buf, bytes, type, true, use_mask ) );
-            return packetlist;
-        }
+    static DynPacketSPtr create_ping_packet( uint8_t* buf, uint32_t bytes, bool use_mask = true )
+    {
+        return create_single_packet( buf, bytes, WS_OP_CODE_PING, true, use_mask );
+    }
 
-        bool first = true;
-        uint32_t chunks = ( uint32_t )bytes / WS_SPLICE_PACKET_SIZE;
-        uint32_t rest   = ( uint32_t )bytes % WS_SPLICE_PACKET_SIZE;
-        for ( uint32_t i = 0; i < chunks; ++i )
-        {
-            bool finish = ( ( i == chunks - 1 ) && ( rest == 0 ) );
-            if ( first )
-            {
-                first = false;
-                packetlist.emplace_back( create_single_packet( buf + i * WS_SPLICE_PACKET_SIZE, WS_SPLICE_PACKET_SIZE, type, finish, use_mask ) );
-            }
-            else
-            {
-                packetlist.emplace_back( create_single_packet( buf + i * WS_SPLICE_PACKET_SIZE, WS_SPLICE_PACKET_SIZE, WS_OP_CODE_CONTINUE, finish, use_mask ) );
-            }
-        }
+    static std::string create_key( std::string const& k )
+    {
+        char accept[WS_ACCEPT_KEY_BYTES + 1];
+        create_accept( k.c_str(), ( uint32_t )k.length(), accept );
+        return std::string( accept, WS_ACCEPT_KEY_BYTES );
+    }
 
-        if ( rest > 0 )
-        {
-            packetlist.emplace_back( create_single_packet( buf + chunks * WS_SPLICE_PACKET_SIZE, rest, WS_OP_CODE_CONTINUE, true, use_mask ) );
-        }
-        return packetlist;
+    /**
+     * @brief 计算Sec-WebSocket-Accept, 直接使用SHA1原始摘要并编码到栈上缓冲区
+     *
+     * @param[out] accept 大小至少为 WS_ACCEPT_KEY_BYTES + 1
+    */
+    static void create_accept( const char* key, uint32_t key_len, char* accept )
+    {
+        uint8_t digest[SHA1_DIGEST_BYTES];
+        Sha1Digest sha1;
+        sha1.update( ( uint8_t const* )key, key_len );
+        sha1.update( ( uint8_t const* )WS_KEY_GUID, WS_KEY_GUID_LEN );
+        sha1.final( digest );
+        base64_encode( digest, SHA1_DIGEST_BYTES, accept );
     }
 
-    static std::string create_key( std::string const& k )
+    /**
+     * @brief 生成完整的101回复, 可以一次写出
+     *
+     * @param[out] buf 大小至少为 WS_ACCEPT_RESP_BYTES
+     * @return 回复长度
+    */
+    static uint32_t create_accept_response( const char* key, uint32_t key_len, char* buf )
     {
-        static const char* codes = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-        auto key = k + codes;
-        std::string sha_tmp = SHA1::encode( key.c_str(), ( uint32_t )key.length() );
-        auto tmp = hex_to_str( sha_tmp );
-        std::string res = Base64::encode( tmp );
-        return res;
+        const uint32_t prefix_len = sizeof( WS_ACCEPT_RESP_PREFIX ) - 1;
+        memcpy( buf, WS_ACCEPT_RESP_PREFIX, prefix_len );
+
+        char accept[WS_ACCEPT_KEY_BYTES + 1];
+        create_accept( key, key_len, accept );
+        memcpy( buf + prefix_len, accept, WS_ACCEPT_KEY_BYTES );
+        memcpy( buf + prefix_len + WS_ACCEPT_KEY_BYTES, "\r\n\r\n", 4 );
+        return WS_ACCEPT_RESP_BYTES;
     }
 
-    static DynPacketSPtr create_single_packet( uint8_t* buf, uint64_t bytes, uint8_t type, bool fin = true, bool use_mask = false )
+    /**
+     * @brief 计算帧头长度
+    */
+    static uint32_t header_bytes( uint64_t bytes, bool use_mask )
     {
         uint32_t header_ext_len = 0;
         if( bytes > WS_MIN_PACKET_SIZE && bytes <= WS_MID_PACKET_SIZE )
             header_ext_len = 2;
         else if( bytes > WS_MID_PACKET_SIZE )
             header_ext_len = 8;
+        return WS_COMMON_HEAD_BYTES + ( use_mask ? 4 : 0 ) + header_ext_len;
+    }
 
-        uint32_t totalbytes = ( uint32_t )bytes + WS_COMMON_HEAD_BYTES + ( use_mask ? 4 : 0 ) + header_ext_len;
-        auto temp = create_default_packet( totalbytes );
-        uint8_t* header = ( uint8_t* )temp->buffer();
+    /**
+     * @brief 填充帧头, 缓冲区大小至少为header_bytes的返回值
+     *
+     * @param[in] mask 掩码 nullptr 表示不使用掩码
+     * @return 帧头长度
+    */
+    static uint32_t create_header( uint8_t* out, uint64_t bytes, uint8_t type, bool fin, uint8_t const* mask )
+    {
+        uint8_t* header = out;
         ( *header ) = fin ? ( WS_FIN_BIT | type ) : type;
         ++header;
 
+        uint8_t mask_bit = ( nullptr != mask ) ? WS_MASK_ENABLE_BIT : 0;
         if ( bytes > WS_MIN_PACKET_SIZE && bytes <= WS_MID_PACKET_SIZE )
         {
-            ( *header ) = WS_MIN_PACKET_SIZE + 1;
-            if ( use_mask )
-            {
-                ( *header ) |= WS_MASK_ENABLE_BIT;
-            }
-            ++header;
-            uint16_t lp = ntohs( ( uint16_t )bytes );
+            ( *header++ ) = ( WS_MIN_PACKET_SIZE + 1 ) | mask_bit;
+            uint16_t lp = htons( ( uint16_t )bytes );
             memcpy( header, ( char* )&lp, sizeof( lp ) );
             header += sizeof( lp );
         }
         else if ( bytes > WS_MID_PACKET_SIZE )
         {
-            ( *header ) = WS_MIN_PACKET_SIZE + 2;
-            if ( use_mask )
-            {
-                ( *header ) |= WS_MASK_ENABLE_BIT;
-            }
-            ++header;
-            uint64_t lp = ntohll( bytes );
+            ( *header++ ) = ( WS_MIN_PACKET_SIZE + 2 ) | mask_bit;
+            uint64_t lp = htonll( bytes );
             memcpy( header, ( char* )&lp, sizeof( lp ) );
             header += sizeof( lp );
         }
         else
         {
-            ( *header ) = ( uint8_t )bytes;
-            if ( use_mask )
-            {
-                ( *header ) |= WS_MASK_ENABLE_BIT;
-            }
-            ++header;
+            ( *header++ ) = ( uint8_t )bytes | mask_bit;
         }
 
+        if ( nullptr != mask )
+        {
+            memcpy( header, mask, 4 );
+            header += 4;
+        }
+        return ( uint32_t )( header - out );
+    }
+
+    /**
+     * @brief 生成掩码
+    */
+    static void create_mask( uint8_t* mask )
+    {
+        auto random = ( uint32_t )FastRandom::local().next();
+        memcpy( mask, ( char* )&random, 4 );
+    }
+
+    /**
+     * @brief 数据加掩码, 掩码运算为异或, 与解掩码相同
+    */
+    static void mask_data( uint8_t* data, uint64_t bytes, uint8_t const* mask )
+    {
+        Utf8Validator::unmask( data, bytes, mask );
+    }
+
+    static DynPacketSPtr create_single_packet( uint8_t* buf, uint64_t bytes, uint8_t type, bool fin = true, bool use_mask = false )
+    {
+        uint64_t totalbytes = bytes + header_bytes( bytes, use_mask );
+        TARO_ASSERT( totalbytes <= UINT32_MAX, "frame too large, use send_stream or send_file", bytes );
+
+        uint8_t mask[4] = { 0 };
+        if ( use_mask )
+        {
+            create_mask( mask );
+        }
+
+        auto temp = create_default_packet( ( uint32_t )totalbytes );
+        uint8_t* header = ( uint8_t* )temp->buffer();
+        header += create_header( header, bytes, type, fin, use_mask ? mask : nullptr );
         if( buf != nullptr && bytes > 0 )
         {
+            memcpy( header, buf, bytes );
             if( use_mask )
             {
-                char mask[4] ={ 0 };
-                auto random = ( uint32_t )rand();
-                memcpy( mask, ( char* )&random, 4 );
-                memcpy( header, ( char* )&random, 4 );
-                header += 4;
-                int32_t i = 0;
-                while( i < ( int32_t )bytes )
-                {
-                    ( *header++ ) = ( *( buf + i ) ) ^ mask[i % 4];
-                    ++i;
-                }
-            }
-            else
-            {
-                memcpy( header, buf, bytes );
+                mask_data( header, bytes, mask );
             }
         }
-        temp->resize( totalbytes );
+        temp->resize( ( uint32_t )totalbytes );
         return temp;
     }
 };
@@ -0,0 +1,113 @@
+﻿
+#pragma once
+
+#include "defs.h"
+#include <cstring>
+#include <chrono>
+#include <random>
+#if !defined( _WIN32 ) && !defined( _WIN64 )
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+NAMESPACE_TARO_WS_BEGIN
+
+// 线程本地的xoshiro256**随机数发生器, 种子取自系统熵源
+// 用于websocket掩码与握手随机串, 不加锁, 不能用于密钥生成
+class FastRandom
+{
+PUBLIC: // function
+
+    /**
+     * @brief 获取当前线程的发生器
+    */
+    static FastRandom& local()
+    {
+        static thread_local FastRandom inst;
+        return inst;
+    }
+
+    uint64_t next()
+    {
+        uint64_t result = rol( s_[1] * 5, 7 ) * 9;
+        uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rol( s_[3], 45 );
+        return result;
+    }
+
+    void fill( uint8_t* buf, uint32_t bytes )
+    {
+        while ( bytes > 0 )
+        {
+            uint64_t v = next();
+            uint32_t len = bytes < sizeof( v ) ? bytes : ( uint32_t )sizeof( v );
+            memcpy( buf, &v, len );
+            buf   += len;
+            bytes -= len;
+        }
+    }
+
+PRIVATE: // function
+
+    FastRandom()
+    {
+        uint64_t seed = 0;
+        if ( !os_entropy( ( uint8_t* )&seed, sizeof( seed ) ) )
+        {
+            std::random_device rd;
+            seed = ( ( uint64_t )rd() << 32 ) ^ rd()
+                 ^ ( uint64_t )std::chrono::high_resolution_clock::now().time_since_epoch().count();
+        }
+
+        // 使用splitmix64展开种子, 保证状态不全为0
+        for ( int32_t i = 0; i < 4; ++i )
+        {
+            seed += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = seed;
+            z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+            z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+            s_[i] = z ^ ( z >> 31 );
+        }
+    }
+
+    static uint64_t rol( uint64_t v, uint32_t n )
+    {
+        return ( v << n ) | ( v >> ( 64 - n ) );
+    }
+
+    static bool os_entropy( uint8_t* buf, size_t bytes )
+    {
+#if defined( _WIN32 ) || defined( _WIN64 )
+        ( void )buf;
+        ( void )bytes;
+        return false;
+#else
+#if defined( SYS_getrandom )
+        if ( ::syscall( SYS_getrandom, buf, bytes, 0 ) == ( long )bytes )
+        {
+            return true;
+        }
+#endif
+        int fd = ::open( "/dev/urandom", O_RDONLY );
+        if ( fd < 0 )
+        {
+            return false;
+        }
+        auto ret = ::read( fd, buf, bytes );
+        ::close( fd );
+        return ret == ( ssize_t )bytes;
+#endif
+    }
+
+PRIVATE: // variable
+
+    uint64_t s_[4];
+};
+
+NAMESPACE_TARO_WS_END
@@ -0,0 +1,235 @@
+﻿
+#pragma once
+
+#include "ws_client.h"
+#include "impl/ws_proto.h"
+#include "impl/utf8_validator.h"
+#include "impl/tracer.h"
+#include "impl/co_event.h"
+#include <net/tcp_client.h>
+#include <co_routine/inc.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+NAMESPACE_TARO_WS_BEGIN
+
+struct WsSession;
+using WsSessionSPtr = std::shared_ptr<WsSession>;
+
+// 等待写入权的数据消息
+struct WsSendWaiter
+{
+    uint64_t ticket;
+    bool     urgent;
+};
+
+// websocket连接会话, 服务端与客户端共用, 保存连接级别的状态
+struct WsSession
+{
+    /**
+     * @brief 构造函数
+     *
+     * @param[in] client   tcp连接
+     * @param[in] use_mask 发送的帧是否使用掩码(客户端为true)
+    */
+    WsSession( net::TcpClientSPtr const& client, bool use_mask )
+        : use_mask_( use_mask )
+        , dead_( false )
+        , hb_waiting_( false )
+        , hb_missed_( 0 )
+        , hb_interval_( 0 )
+        , hb_max_missed_( 0 )
+        , rtt_ms_( -1 )
+        , recv_kind_( eWsDataKindInvalid )
+        , sending_( false )
+        , next_ticket_( 0 )
+        , frag_bytes_( WS_SPLICE_PACKET_SIZE )
+        , conn_id_( 0 )
+        , client_( client )
+    {
+
+    }
+
+    /**
+     * @brief 发送控制帧, 写入权被占用时先入队, 由持有写入权的一方在分片之间或释放前发送
+     *        直接发送期间同样占用写入权, 数据消息不会在控制帧的部分写入之间开始
+     *
+     * @param[in] ms 直接发送的超时时间 0 表示不限
+    */
+    bool send_ctrl( DynPacketSPtr const& packet, uint32_t ms = 0 )
+    {
+        {
+            std::lock_guard<std::mutex> lock( send_mutex_ );
+            if ( sending_ )
+            {
+                ctrl_queue_.push_back( packet );
+                return true;
+            }
+            sending_ = true;
+        }
+        return release( client_->send( ( char* )packet->buffer(), packet->size(), ms ) >= 0 );
+    }
+
+    /**
+     * @brief 获取数据消息的写入权, 同一连接上的数据消息不能交错
+     *        等待方按先后顺序获得写入权, 紧急消息排在所有普通消息之前
+    */
+    void begin_send( bool urgent )
+    {
+        uint64_t ticket = 0;
+        {
+            std::lock_guard<std::mutex> lock( send_mutex_ );
+            if ( !sending_ && waiters_.empty() )
+            {
+                sending_ = true;
+                return;
+            }
+
+            ticket = ++next_ticket_;
+            auto pos = waiters_.end();
+            if ( urgent )
+            {
+                pos = std::find_if( waiters_.begin(), waiters_.end(), []( WsSendWaiter const& one )
+                {
+                    return !one.urgent;
+                } );
+            }
+            waiters_.insert( pos, WsSendWaiter{ ticket, urgent } );
+        }
+
+        while ( 1 )
+        {
+            auto seen = send_event_.generation();
+            {
+                std::lock_guard<std::mutex> lock( send_mutex_ );
+                if ( !sending_ && waiters_.front().ticket == ticket )
+                {
+                    waiters_.pop_front();
+                    sending_ = true;
+                    return;
+                }
+            }
+            send_event_.wait( seen );
+        }
+    }
+
+    /**
+     * @brief 发送剩余的控制帧后释放写入权
+    */
+    bool end_send()
+    {
+        return release( true );
+    }
+
+    /**
+     * @brief 在分片之间发送排队的控制帧
+    */
+    bool flush_ctrl()
+    {
+        std::list<DynPacketSPtr> pending;
+        {
+            std::lock_guard<std::mutex> lock( send_mutex_ );
+            pending.swap( ctrl_queue_ );
+        }
+        return send_list( pending );
+    }
+
+    /**
+     * @brief 根据分片的发送耗时调整分片大小, 使单个分片占用连接的时间接近目标值,
+     *        发送缓冲区满或网络拥塞时send耗时变长, 分片随之变小, 控制帧的等待时间也随之受限
+     *
+     * @param[in] bytes   本次分片大小
+     * @param[in] cost_ms 本次分片发送耗时
+    */
+    void adapt_frag( uint32_t bytes, uint64_t cost_ms )
+    {
+        if ( cost_ms > WS_FRAG_TARGET_MS )
+        {
+            frag_bytes_ = std::max<uint32_t>( frag_bytes_ / 2, WS_MIN_FRAG_SIZE );
+        }
+        else if ( cost_ms * 2 < WS_FRAG_TARGET_MS && bytes >= frag_bytes_ )
+        {
+            frag_bytes_ = std::min<uint32_t>( frag_bytes_ * 2, WS_MAX_FRAG_SIZE );
+        }
+    }
+
+    bool                  use_mask_;
+    std::atomic<bool>     dead_;           // 心跳超时被关闭
+    std::atomic<bool>     hb_waiting_;     // 已发送ping, 等待pong
+    std::atomic<uint32_t> hb_missed_;      // 连续未收到pong的次数
+    uint32_t              hb_interval_;    // 心跳间隔(ms) 0表示不启用
+    uint32_t              hb_max_missed_;  // 允许丢失pong的最大次数
+    std::atomic<int32_t>  rtt_ms_;         // 最近一次往返时延 -1表示未知
+    EWsDataKind           recv_kind_;      // 正在接收的消息类型, 用于延续帧
+    Utf8Validator         utf8_;           // 文本消息的UTF-8校验状态
+    bool                  sending_;        // 写入权是否被占用(数据消息或直接发送的控制帧)
+    uint64_t              next_ticket_;    // 等待写入权的序号
+    uint32_t              frag_bytes_;     // 当前分片大小
+    std::mutex            send_mutex_;
+    std::list<DynPacketSPtr> ctrl_queue_;  // 待插入发送的控制帧
+    std::deque<WsSendWaiter> waiters_;     // 等待写入权的数据消息, 按获得顺序排列
+    CoEvent               send_event_;     // 写入权释放时通知等待方
+    uint64_t              conn_id_;        // 服务端连接的跟踪ID, 客户端为0
+    net::TcpClientSPtr    client_;
+
+PRIVATE: // function
+
+    /**
+     * @brief 发送排队的控制帧直到队列为空, 然后释放写入权并唤醒等待方
+     *
+     * @param[in] ok 之前的发送是否成功, 失败时丢弃排队的控制帧
+    */
+    bool release( bool ok )
+    {
+        while ( 1 )
+        {
+            std::list<DynPacketSPtr> pending;
+            {
+                std::lock_guard<std::mutex> lock( send_mutex_ );
+                if ( !ok || ctrl_queue_.empty() )
+                {
+                    ctrl_queue_.clear();
+                    sending_ = false;
+                    break;
+                }
+                pending.swap( ctrl_queue_ );
+            }
+            ok = send_list( pending );
+        }
+        send_event_.notify();
+        return ok;
+    }
+
+    bool send_list( std::list<DynPacketSPtr> const& packets )
+    {
+        for ( auto const& one : packets )
+        {
+            if ( client_->send( ( char* )one->buffer(), one->size() ) < 0 )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// 数据消息发送权的作用域守护
+struct WsSendGuard
+{
+    WsSendGuard( WsSession& session, bool urgent )
+        : session_( session )
+    {
+        session_.begin_send( urgent );
+    }
+
+    ~WsSendGuard()
+    {
+        session_.end_send();
+    }
+
+    WsSession& session_;
+};
+
+NAMESPACE_TARO_WS_END
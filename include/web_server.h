@@ -3,13 +3,155 @@
 
 #include "ws_client.h"
 #include "http_client.h"
+#include "http_body_buffer.h"
 #include <net/defs.h>
 #include <base/memory/dyn_packet.h>
+#include <vector>
 
 NAMESPACE_TARO_WS_BEGIN
 
 struct WebServerImpl;
 
+/**
+ * @brief 数据体接收前的检查函数, 请求头解析后调用, 用于鉴权 配额 大小等检查
+ * 
+ * @param[in] http请求
+ * @return eHttpRespCodeOK 继续接收数据体 其余状态码直接回复并断开连接, 数据体不再读取
+*/
+using HttpPreHandler = std::function< int32_t( HttpRequestSPtr const& ) >;
+
+// 路径处理配置
+struct HttpRoutineOpt
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpRoutineOpt()
+        : stream_body( false )
+        , slice_bytes( 0x10000 )
+        , max_body_bytes( 0 )
+        , spill_bytes( HTTP_SPILL_BYTES )
+        , offload( false )
+        , max_inflight( 0 )
+    {
+
+    }
+
+    bool     stream_body;     // Content-Length数据体按段交给处理函数, 与chunk请求相同, 最后以nullptr结束
+    uint32_t slice_bytes;     // 分段交付时每段的长度
+    uint64_t max_body_bytes;  // 数据体上限, 超过时不读取数据体直接回复413 0 表示不限
+    HttpPreHandler pre_handler; // 数据体接收前的检查, 通过后才对Expect: 100-continue回复100 可以为nullptr
+    uint64_t spill_bytes;     // 缓存数据体时的内存上限, 超过后转存到临时文件, 仅set_buffered_routine使用
+    std::string spill_dir;    // 临时文件目录 空表示系统临时目录
+    bool offload;             // 处理函数在工作线程池中执行, 连接协程等待期间不占用调度线程, 回复暂存后由连接协程发送
+    uint32_t max_inflight;    // 该路径同时处理的请求数上限, 超过时回复503 0 表示不限
+};
+
+// 准入控制配置, 超过限制的连接与请求回复503并关闭连接
+struct HttpAdmitOpt
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpAdmitOpt()
+        : max_conns( 0 )
+        , max_inflight( 0 )
+        , target_delay_ms( 0 )
+        , interval_ms( 100 )
+        , retry_after_s( 1 )
+    {
+
+    }
+
+    uint32_t max_conns;       // 最大连接数 0 表示不限
+    uint32_t max_inflight;    // 同时处理的请求数上限 0 表示不限
+    uint32_t target_delay_ms; // 调度排队延时的目标值, 一个周期内的最小延时超过该值时开始丢弃请求(CoDel) 0 表示关闭
+    uint32_t interval_ms;     // CoDel的观测周期
+    uint32_t retry_after_s;   // 503回复中Retry-After的秒数
+};
+
+// 处理函数卸载的统计, 用于评估线程池大小
+struct HttpOffloadStats
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpOffloadStats()
+        : threads( 0 )
+        , queue_depth( 0 )
+        , executed( 0 )
+        , wait_us_total( 0 )
+        , wait_us_max( 0 )
+    {
+
+    }
+
+    uint32_t threads;         // 工作线程数
+    uint32_t queue_depth;     // 排队中的任务数
+    uint64_t executed;        // 已执行的任务数
+    uint64_t wait_us_total;   // 任务排队时间总和(us)
+    uint64_t wait_us_max;     // 任务排队时间最大值(us)
+};
+
+// 限速配置, 每个key一个令牌桶, rate为0的检查点不限速
+struct HttpRateOpt
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpRateOpt()
+        : conn_rate( 0 )
+        , conn_burst( 20 )
+        , req_rate( 0 )
+        , req_burst( 50 )
+        , ws_rate( 0 )
+        , ws_burst( 100 )
+        , capacity( 1 << 18 )
+    {
+
+    }
+
+    double   conn_rate;   // 每个key每秒允许的新连接数
+    uint32_t conn_burst;
+    double   req_rate;    // 每个key每秒允许的请求数, 超过时回复429并关闭连接
+    uint32_t req_burst;
+    double   ws_rate;     // 每个key每秒允许的websocket消息数, 超过的消息被丢弃
+    uint32_t ws_burst;
+    uint32_t capacity;    // 每个检查点令牌桶表的槽数, 占满后淘汰最久未使用的key
+};
+
+// 访问日志配置, 每个请求结束时写入一行JSON
+struct HttpAccessLogOpt
+{
+    /**
+     * @brief 构造函数
+    */
+    HttpAccessLogOpt()
+        : max_bytes( 64ULL << 20 )
+        , max_files( 5 )
+        , ring_records( 4096 )
+        , flush_ms( 200 )
+    {
+
+    }
+
+    std::string path;       // 日志文件路径
+    uint64_t max_bytes;     // 单个文件的大小上限, 超过后轮转为path.1 path.2 ... 0 表示不轮转
+    uint32_t max_files;     // 保留的历史文件数
+    uint32_t ring_records;  // 每个调度线程的缓冲记录数, 写满时丢弃记录并计数
+    uint32_t flush_ms;      // 后台线程的写入间隔(ms)
+};
+
+/**
+ * @brief 连接的限速key提取函数, 通常返回对端ip, 每个连接调用一次
+*/
+using HttpConnKeyFunc = std::function< std::string( net::TcpClientSPtr const& ) >;
+
+/**
+ * @brief 请求的限速key提取函数, 例如按API key或代理转发的地址限速, 返回空字符串表示不限速
+*/
+using HttpReqKeyFunc = std::function< std::string( HttpRequestSPtr const& ) >;
+
 // web服务对象
 class TARO_DLL_EXPORT WebServer
 {
@@ -25,6 +167,16 @@ PUBLIC: // 公共类型
     */
     using HttpRoutineHandler = std::function< bool( HttpClientSPtr, HttpRequestSPtr const&, DynPacketSPtr const& ) >;
 
+    /**
+     * @brief 缓存数据体的HTTP处理函数
+     * 
+     * @param[in] http客户端
+     * @param[in] http请求
+     * @param[in] 完整的数据体或boundary请求的一个part, nullptr 表示请求结束
+     * @return true 保持连接  false 断开连接 
+    */
+    using HttpBufferHandler = std::function< bool( HttpClientSPtr, HttpRequestSPtr const&, HttpBodyBuffer* ) >;
+
     /**
      * @brief websocket处理函数
      * 
@@ -60,8 +212,19 @@ PUBLIC: // 公共函数
      * 
      * @param[in] url 
      * @param[in] handler 处理函数
+     * @param[in] opt     处理配置
     */
-    int32_t set_routine( const char* url, HttpRoutineHandler const& handler );
+    int32_t set_routine( const char* url, HttpRoutineHandler const& handler, HttpRoutineOpt const& opt = HttpRoutineOpt() );
+
+    /**
+     * @brief 设置缓存数据体的路径处理函数, 数据体边接收边写入HttpBodyBuffer, 超过spill_bytes后转存到临时文件
+     *        boundary请求的每个part单独缓存, 内存占用与数据体大小无关
+     * 
+     * @param[in] url 
+     * @param[in] handler 处理函数
+     * @param[in] opt     处理配置, stream_body与slice_bytes不生效
+    */
+    int32_t set_buffered_routine( const char* url, HttpBufferHandler const& handler, HttpRoutineOpt const& opt = HttpRoutineOpt() );
 
     /**
      * @brief 设置静态文件的路径
@@ -77,6 +240,100 @@ PUBLIC: // 公共函数
     */
     int32_t set_ws_handler( WebsocketHandler const& handler );
 
+    /**
+     * @brief 设置websocket心跳, 心跳超时的连接会被关闭并以eWsEventTimeout通知处理函数
+     * 
+     * @param[in] interval_ms 发送ping的间隔 0 表示关闭心跳
+     * @param[in] max_missed  允许连续丢失pong的次数
+    */
+    int32_t set_ws_heartbeat( uint32_t interval_ms, uint32_t max_missed = 3 );
+
+    /**
+     * @brief 设置请求数据体的解压, 默认开启
+     *        Content-Encoding为gzip或deflate的请求边接收边解压后交给处理函数, 超过上限回复413, 数据错误回复400
+     *        解压的请求在100-continue检查之后去掉Content-Encoding与Content-Length, 处理函数看到的请求头与数据体一致
+     * 
+     * @param[in] enable    是否解压
+     * @param[in] max_bytes 解压后的数据体上限
+    */
+    void set_decode( bool enable, uint64_t max_bytes = HTTP_DECODE_MAX_BYTES );
+
+    /**
+     * @brief 设置回复压缩, 根据请求的Accept-Encoding对处理函数的回复做流式gzip(或brotli)压缩, 以chunk方式发送
+     *        已设置Content-Encoding的回复与boundary回复不压缩
+     * 
+     * @param[in] enable 是否压缩
+     * @param[in] opt    压缩配置
+    */
+    int32_t set_compress( bool enable, HttpCompressOpt const& opt = HttpCompressOpt() );
+
+    /**
+     * @brief 设置处理函数卸载的工作线程数, 需在start前调用
+     *        未调用时在首个设置offload的路径注册时按CPU核数创建
+     * 
+     * @param[in] threads 线程数 0 表示CPU核数
+    */
+    int32_t set_offload( uint32_t threads = 0 );
+
+    /**
+     * @brief 获取处理函数卸载的统计
+    */
+    HttpOffloadStats offload_stats() const;
+
+    /**
+     * @brief 设置限速, 需在start前调用, 在接受连接, 查找处理函数前与websocket消息到达时按key取令牌
+     * 
+     * @param[in] opt      限速配置
+     * @param[in] conn_key 连接的key提取函数, 连接与websocket限速及未设置req_key时的请求限速使用
+     * @param[in] req_key  请求的key提取函数 可以为nullptr
+    */
+    int32_t set_rate_limit( HttpRateOpt const& opt, HttpConnKeyFunc const& conn_key, HttpReqKeyFunc const& req_key = nullptr );
+
+    /**
+     * @brief 设置准入控制, 需在start前调用
+     * 
+     * @param[in] opt 准入配置
+    */
+    int32_t set_admission( HttpAdmitOpt const& opt );
+
+    /**
+     * @brief 开启访问日志, 需在start前调用
+     *        请求结束时在连接协程中写入定长记录到本线程的无锁缓冲, 由后台线程批量格式化并写入文件
+     *        peer为set_rate_limit中conn_key的结果, 未设置时为空
+     * 
+     * @param[in] opt 访问日志配置
+    */
+    int32_t set_access_log( HttpAccessLogOpt const& opt );
+
+    /**
+     * @brief 开启指标记录, 需在start前调用
+     *        记录连接数, 各路径的请求数与处理耗时, 状态码, 收发字节数, 请求头解析耗时, websocket帧数与各队列深度
+     *        计数按线程分片, 记录时只有一次无竞争的原子加, 读取时合并
+     * 
+     * @param[in] url 以Prometheus文本格式输出指标的路径 nullptr 表示不注册, 通过metrics()读取
+    */
+    int32_t set_metrics( const char* url = "/metrics" );
+
+    /**
+     * @brief 以Prometheus文本格式输出指标, 未开启时为空
+    */
+    std::string metrics() const;
+
+    /**
+     * @brief 开启或关闭进程内的环形跟踪, 可在运行中调用, 进程内所有服务共用一个缓冲
+     *        记录接受连接 请求头解析 查找处理函数 处理函数开始与结束 回复首次发送 websocket帧收发 连接关闭
+     *        编译时定义WS_USE_USDT则同时提供同名的USDT探针, 可由perf或bpftrace挂载
+     * 
+     * @param[in] events 缓冲的事件数, 写满后覆盖最旧的事件 0 表示关闭
+     * @param[in] url    导出最近事件的路径, 只能在start前注册 nullptr 表示不注册
+    */
+    int32_t set_trace( uint32_t events, const char* url = nullptr );
+
+    /**
+     * @brief 导出缓冲中最近的跟踪事件, 每行一个
+    */
+    std::string trace_dump() const;
+
 PRIVATE: // 私有函数
 
     TARO_NO_COPY( WebServer );
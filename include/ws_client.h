@@ -4,6 +4,7 @@
 #include "defs.h"
 #include <net/defs.h>
 #include <base/memory/dyn_packet.h>
+#include <functional>
 
 NAMESPACE_TARO_WS_BEGIN
 
@@ -15,6 +16,7 @@ enum EWsEvent
     eWsEventOpen,
     eWsEventMsg,
     eWsEventClose,    // 对方主动断线
+    eWsEventTimeout,  // 心跳超时, 连接已被关闭
     eWsEventInvalid,
 };
 
@@ -48,6 +50,15 @@ struct WsRecvData
     DynPacketSPtr body;       // 数据体 
 };
 
+/**
+ * @brief 流式发送的数据拉取函数
+ * 
+ * @param[in] buf   数据缓冲
+ * @param[in] bytes 缓冲大小
+ * @return 读取的字节数 0 表示数据结束 小于0 表示失败
+*/
+using WsPullFunc = std::function< int64_t( uint8_t*, uint32_t ) >;
+
 // websocket客户端
 class TARO_DLL_EXPORT WsClient
 {
@@ -70,8 +81,10 @@ PUBLIC: // 公共函数
      * @param[in] port 服务端口号
      * @param[in] url  路径信息
      * @param[in] ctx  加密通信的环境配置
+     * @param[in] ms   连接与握手的总超时时间 0 表示一直阻塞
+     * @return TARO_OK 成功 TARO_ERR_TIMEOUT 超时 其余表示失败
     */
-    int32_t open( const char* host, uint16_t port = 80, const char* url = "/", net::SSLContext* ctx = nullptr);
+    int32_t open( const char* host, uint16_t port = 80, const char* url = "/", net::SSLContext* ctx = nullptr, uint32_t ms = 0 );
 
     /**
      * @brief 发送数据
@@ -81,14 +94,63 @@ PUBLIC: // 公共函数
      * @param[in] kind     数据类型
      * @param[in] use_mask 是否使用掩码
     */
-    bool send( char* buffer, int32_t bytes, EWsDataKind const& kind = eWsDataKindText, bool use_mask = false );
+    bool send( char* buffer, uint64_t bytes, EWsDataKind const& kind = eWsDataKindText, bool use_mask = false );
+
+    /**
+     * @brief 发送紧急数据, 在等待发送的普通消息之前获得发送权
+     *        websocket的数据消息不能交错, 紧急消息需要等待正在发送的消息结束; 控制帧则在分片之间随时插入
+     * 
+     * @param[in] buffer   数据缓冲
+     * @param[in] bytes    数据大小
+     * @param[in] kind     数据类型
+     * @param[in] use_mask 是否使用掩码
+    */
+    bool send_urgent( char* buffer, uint64_t bytes, EWsDataKind const& kind = eWsDataKindText, bool use_mask = false );
+
+    /**
+     * @brief 流式发送, 数据按分片逐段拉取并发送, 内存占用与消息大小无关
+     * 
+     * @param[in] pull     数据拉取函数
+     * @param[in] kind     数据类型
+     * @param[in] use_mask 是否使用掩码
+     * @return 失败时消息可能已发出一部分, 连接应当关闭
+    */
+    bool send_stream( WsPullFunc const& pull, EWsDataKind const& kind = eWsDataKindBinary, bool use_mask = false );
+
+    /**
+     * @brief 发送文件中的一段数据
+     * 
+     * @param[in] fd       文件描述符
+     * @param[in] offset   起始位置
+     * @param[in] bytes    数据大小
+     * @param[in] kind     数据类型
+     * @param[in] use_mask 是否使用掩码
+    */
+    bool send_file( int32_t fd, uint64_t offset, uint64_t bytes, EWsDataKind const& kind = eWsDataKindBinary, bool use_mask = false );
 
     /**
      * @brief 数据接收
      * 
-     * @return 见WsRespRet定义
+     * @param[in] ms 接收一帧的总超时时间 0 表示一直阻塞
+     *               超时发生在帧之间时连接保持可用, 发生在帧中间时连接被关闭
+     * @return 见WsRespRet定义, 超时时ret为TARO_ERR_TIMEOUT
+    */
+    WsRecvData recv( uint32_t ms = 0 );
+
+    /**
+     * @brief 设置心跳, 定时发送ping并统计往返时延, 连续丢失pong达到上限时关闭连接
+     * 
+     * @param[in] interval_ms 发送ping的间隔 0 表示关闭心跳
+     * @param[in] max_missed  允许连续丢失pong的次数
+    */
+    int32_t set_heartbeat( uint32_t interval_ms, uint32_t max_missed = 3 );
+
+    /**
+     * @brief 获取最近一次心跳的往返时延
+     * 
+     * @return 时延(ms) -1 表示未知
     */
-    WsRecvData recv();
+    int32_t rtt() const;
 
 PRIVATE: // 私有类型
     
@@ -0,0 +1,309 @@
+﻿#include "http_body_buffer.h"
+#include "impl/file_io.h"
+#include "impl/work_pool.h"
+#include "impl/co_event.h"
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+NAMESPACE_TARO_WS_BEGIN
+
+#define HTTP_SPILL_WRITE_BYTES 0x40000 // 转存后每次交给工作线程写入文件的块大小
+#define HTTP_SPILL_MAX_BLOCKS  4       // 每个数据体等待写入文件的最大块数, 超过后挂起等待
+#define HTTP_SPILL_THREADS     2       // 写临时文件的工作线程数
+
+// 临时文件的写入状态, 由数据体与写入任务共享, 最后一方释放时关闭文件
+struct HttpSpillFile
+{
+    explicit HttpSpillFile( int32_t file )
+        : fd( file )
+        , written( 0 )
+        , writing( false )
+        , failed( false )
+    {}
+
+    ~HttpSpillFile()
+    {
+        close_fd( fd );
+    }
+
+    int32_t fd;
+    uint64_t written;               // 已写入文件的大小
+    bool writing;                   // 是否有写入任务在执行, 同一文件同时只有一个任务, 保证块的顺序
+    bool failed;                    // 写入失败
+    std::mutex mutex;
+    std::deque<std::string> blocks; // 等待写入的块, 写入完成后才移除, 期间读取仍可以从内存中取得
+    CoEvent event;                  // 块写入完成时通知
+};
+
+using HttpSpillFileSPtr = std::shared_ptr<HttpSpillFile>;
+
+/**
+ * @brief 写临时文件的线程池, 首次转存时创建, 阻塞的文件写入不占用协程的调度线程
+*/
+static WorkPool& spill_pool()
+{
+    static WorkPool pool( HTTP_SPILL_THREADS );
+    return pool;
+}
+
+/**
+ * @brief 在工作线程中按顺序写出排队的块, 队列为空或写入失败时结束
+*/
+static void spill_task( HttpSpillFileSPtr const& file )
+{
+    while ( 1 )
+    {
+        std::string const* block = nullptr;
+        {
+            std::lock_guard<std::mutex> lock( file->mutex );
+            if ( file->blocks.empty() || file->failed )
+            {
+                file->writing = false;
+                break;
+            }
+            block = &file->blocks.front(); // 尾部追加不影响已有元素的引用
+        }
+
+        bool ok = write_all( file->fd, ( uint8_t const* )block->data(), block->size() );
+        {
+            std::lock_guard<std::mutex> lock( file->mutex );
+            if ( ok )
+            {
+                file->written += block->size();
+                file->blocks.pop_front();
+            }
+            else
+            {
+                file->failed = true;
+            }
+        }
+        file->event.notify();
+    }
+    file->event.notify();
+}
+
+struct HttpBodyBufferImpl
+{
+    HttpBodyBufferImpl()
+        : total_( 0 )
+        , spill_bytes_( 0 )
+    {}
+
+    /**
+     * @brief 将缓存的数据作为一块交给工作线程写入, 等待写入的块达到上限时挂起当前协程
+    */
+    bool submit_pending()
+    {
+        if ( pending_.empty() )
+        {
+            return true;
+        }
+
+        bool start = false;
+        while ( 1 )
+        {
+            auto seen = file_->event.generation();
+            {
+                std::lock_guard<std::mutex> lock( file_->mutex );
+                if ( file_->failed )
+                {
+                    WS_ERROR << "write temp file failed";
+                    return false;
+                }
+
+                if ( file_->blocks.size() < HTTP_SPILL_MAX_BLOCKS )
+                {
+                    file_->blocks.emplace_back();
+                    file_->blocks.back().swap( pending_ );
+                    start = !file_->writing;
+                    file_->writing = true;
+                    break;
+                }
+            }
+            file_->event.wait( seen );
+        }
+
+        if ( start )
+        {
+            auto file = file_;
+            spill_pool().submit( [file]()
+            {
+                spill_task( file );
+            } );
+        }
+        return true;
+    }
+
+    /**
+     * @brief 等待已提交的块全部写入文件
+    */
+    bool wait_written()
+    {
+        while ( 1 )
+        {
+            auto seen = file_->event.generation();
+            {
+                std::lock_guard<std::mutex> lock( file_->mutex );
+                if ( file_->failed )
+                {
+                    WS_ERROR << "write temp file failed";
+                    return false;
+                }
+
+                if ( !file_->writing && file_->blocks.empty() )
+                {
+                    return true;
+                }
+            }
+            file_->event.wait( seen );
+        }
+    }
+
+    HttpSpillFileSPtr file_;  // 临时文件 nullptr 表示数据在内存中
+    uint64_t total_;
+    uint64_t spill_bytes_;
+    std::string dir_;
+    std::string pending_;     // 未转存时为全部数据, 转存后为未满一块的数据
+};
+
+HttpBodyBuffer::HttpBodyBuffer( uint64_t spill_bytes, const char* dir )
+    : impl_( new HttpBodyBufferImpl )
+{
+    impl_->spill_bytes_ = spill_bytes;
+    if ( STRING_CHECK( dir ) )
+    {
+        impl_->dir_ = dir;
+    }
+    else
+    {
+        auto env = getenv( "TMPDIR" );
+        impl_->dir_ = STRING_CHECK( env ) ? env : "/tmp";
+    }
+}
+
+HttpBodyBuffer::~HttpBodyBuffer()
+{
+    // 仍在写入时由写入任务持有文件, 结束后关闭
+    delete impl_;
+}
+
+int32_t HttpBodyBuffer::append( uint8_t const* data, uint32_t bytes )
+{
+    if ( bytes == 0 )
+    {
+        return TARO_OK;
+    }
+
+    if ( impl_->file_ == nullptr && impl_->total_ + bytes > impl_->spill_bytes_ )
+    {
+        auto fd = open_temp( impl_->dir_.c_str() );
+        if ( fd < 0 )
+        {
+            WS_ERROR << "create temp file failed dir:" << impl_->dir_;
+            return TARO_ERR_FAILED;
+        }
+
+        // 内存中的数据整体作为一块写入文件, 写完后释放
+        impl_->file_ = std::make_shared<HttpSpillFile>( fd );
+        if ( !impl_->submit_pending() )
+        {
+            return TARO_ERR_FAILED;
+        }
+    }
+
+    impl_->total_ += bytes;
+    if ( impl_->file_ == nullptr )
+    {
+        impl_->pending_.append( ( const char* )data, bytes );
+        return TARO_OK;
+    }
+
+    // 按块切分, 满一块即交给工作线程写入
+    while ( bytes > 0 )
+    {
+        auto len = ( uint32_t )std::min<size_t>( bytes, HTTP_SPILL_WRITE_BYTES - impl_->pending_.size() );
+        impl_->pending_.append( ( const char* )data, len );
+        data  += len;
+        bytes -= len;
+        if ( impl_->pending_.size() >= HTTP_SPILL_WRITE_BYTES && !impl_->submit_pending() )
+        {
+            return TARO_ERR_FAILED;
+        }
+    }
+    return TARO_OK;
+}
+
+int32_t HttpBodyBuffer::flush()
+{
+    if ( impl_->file_ == nullptr )
+    {
+        return TARO_OK;
+    }
+    return ( impl_->submit_pending() && impl_->wait_written() ) ? TARO_OK : TARO_ERR_FAILED;
+}
+
+uint64_t HttpBodyBuffer::size() const
+{
+    return impl_->total_;
+}
+
+bool HttpBodyBuffer::spilled() const
+{
+    return impl_->file_ != nullptr;
+}
+
+uint8_t const* HttpBodyBuffer::data() const
+{
+    return impl_->file_ == nullptr ? ( uint8_t const* )impl_->pending_.data() : nullptr;
+}
+
+int32_t HttpBodyBuffer::fd() const
+{
+    return impl_->file_ == nullptr ? -1 : impl_->file_->fd;
+}
+
+int64_t HttpBodyBuffer::read( uint64_t offset, uint8_t* buf, uint32_t bytes ) const
+{
+    if ( offset >= impl_->total_ )
+    {
+        return 0;
+    }
+
+    auto const& file = impl_->file_;
+    if ( file == nullptr )
+    {
+        auto len = ( uint32_t )std::min<uint64_t>( bytes, impl_->total_ - offset );
+        memcpy( buf, impl_->pending_.data() + offset, len );
+        return len;
+    }
+
+    // 文件之后依次是等待写入的块和未满一块的缓存
+    uint64_t pos = 0;
+    {
+        std::lock_guard<std::mutex> lock( file->mutex );
+        pos = file->written;
+        if ( offset >= pos )
+        {
+            for ( auto const& one : file->blocks )
+            {
+                if ( offset < pos + one.size() )
+                {
+                    auto len = ( uint32_t )std::min<uint64_t>( bytes, pos + one.size() - offset );
+                    memcpy( buf, one.data() + ( offset - pos ), len );
+                    return len;
+                }
+                pos += one.size();
+            }
+
+            auto len = ( uint32_t )std::min<uint64_t>( bytes, impl_->total_ - offset );
+            memcpy( buf, impl_->pending_.data() + ( offset - pos ), len );
+            return len;
+        }
+    }
+    return read_at( file->fd, buf, ( uint32_t )std::min<uint64_t>( bytes, pos - offset ), offset );
+}
+
+NAMESPACE_TARO_WS_END
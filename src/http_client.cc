@@ -1,9 +1,17 @@
 ﻿
 #include "impl/http_client_impl.h"
 #include "impl/http_proto_impl.h"
+#include "impl/file_io.h"
+#include <algorithm>
+#include <cstdio>
 
 NAMESPACE_TARO_WS_BEGIN
 
+#define HTTP_SLICE_PACK_SIZE 0x10000 // 分段接收数据体时单次接收的大小
+#define HTTP_UPLOAD_BUF_SIZE 0x10000 // 上传文件时单次读取的大小
+#define HTTP_CHUNK_HEAD_ROOM 16      // chunk长度行预留的空间
+
+
 HttpClient::HttpClient( net::SSLContext* ctx )
     : impl_( new HttpClientImpl )
 {
@@ -18,7 +26,7 @@ HttpClient::~HttpClient()
     delete impl_;
 }
 
-int32_t HttpClient::connect( const char* ip, uint16_t port )
+int32_t HttpClient::connect( const char* ip, uint16_t port, uint32_t ms )
 {
     if ( !impl_->active_ )
     {
@@ -40,16 +48,17 @@ int32_t HttpClient::connect( const char* ip, uint16_t port )
 
     auto tcp_cli = net::create_tcp_cli( impl_->ctx_.valid() ? impl_->ctx_.pointer() : nullptr );
     TARO_ASSERT( tcp_cli != nullptr, "create tcp client failed" );
-    if( tcp_cli->connect( ip, port ) )
+    auto ret = connect_until( tcp_cli, ip, port, Deadline( ms ) );
+    if( ret == TARO_OK )
     {
         impl_->client_ = tcp_cli;
         return TARO_OK;
     }
     WS_ERROR << "connect to " << ip  << ":" << port << "failed";
-    return TARO_ERR_FAILED;
+    return ret;
 }
 
-int32_t HttpClient::send_req( HttpRequest const& req )
+int32_t HttpClient::send_req( HttpRequest const& req, uint32_t ms )
 {
     if( impl_->client_ == nullptr )
     {
@@ -69,7 +78,30 @@ int32_t HttpClient::send_req( HttpRequest const& req )
         WS_ERROR << "serialize failed";
         return TARO_ERR_INVALID_ARG;
     }
-    return impl_->client_->send( ( char* )str.c_str(), str.length() );
+    return impl_->write( ( char* )str.c_str(), str.length(), ms );
+}
+
+int32_t HttpClient::send_expect( HttpRequest const& req, uint32_t ms )
+{
+    if( impl_->client_ == nullptr )
+    {
+        WS_ERROR << "connect is invalid";
+        return TARO_ERR_INVALID_RES;
+    }
+
+    if( !req.valid() )
+    {
+        WS_ERROR << "http request is invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+
+    auto str = HttpRequestImpl::serialize_expect( req );
+    auto ret = impl_->write( ( char* )str.c_str(), str.length() );
+    if ( ret < 0 )
+    {
+        return ret;
+    }
+    return HttpClientImpl::wait_continue( *this, Deadline( ms ) );
 }
 
 int32_t HttpClient::send_resp( HttpResponse const& resp )
@@ -86,16 +118,38 @@ int32_t HttpClient::send_resp( HttpResponse const& resp )
         return TARO_ERR_INVALID_ARG;
     }
 
-    auto str = HttpResponseImpl::serialize( resp );
+    // 压缩的回复改为chunk传输, 数据体在send_body或send_chunk_body中压缩
+    std::string str;
+    bool chunked = false;
+    uint64_t length = 0;
+    if ( impl_->should_compress( resp, chunked, length )
+      && impl_->deflater_.begin( impl_->accept_enc_, impl_->compress_opt_->level ) )
+    {
+        impl_->deflating_       = true;
+        impl_->deflate_chunked_ = chunked;
+        impl_->deflate_remain_  = length;
+        str = HttpResponseImpl::serialize_encoded( resp, HttpDeflater::name( impl_->accept_enc_ ) );
+    }
+    else
+    {
+        str = HttpResponseImpl::serialize( resp );
+    }
+
     if ( str.empty() )
     {
         WS_ERROR << "serialize failed";
         return TARO_ERR_INVALID_ARG;
     }
-    return impl_->client_->send( ( char* )str.c_str(), str.length() );
+
+    impl_->resp_code_ = resp.code();
+    if ( impl_->metrics_ != nullptr )
+    {
+        impl_->metrics_->add_status( resp.code() );
+    }
+    return impl_->write( ( char* )str.c_str(), str.length() );
 }
 
-int32_t HttpClient::send_body( DynPacketSPtr const& body )
+int32_t HttpClient::send_body( DynPacketSPtr const& body, uint32_t ms )
 {
     if( nullptr == body 
      || nullptr == body->buffer() 
@@ -110,32 +164,39 @@ int32_t HttpClient::send_body( DynPacketSPtr const& body )
         WS_ERROR << "connect is invalid";
         return TARO_ERR_INVALID_RES;
     }
-    return impl_->client_->send( ( char* )body->buffer(), body->size() );
+
+    if ( impl_->deflating_ && !impl_->deflate_chunked_ )
+    {
+        impl_->deflate_remain_ -= std::min<uint64_t>( impl_->deflate_remain_, body->size() );
+        auto ret = impl_->send_compressed( body->buffer(), body->size(), impl_->deflate_remain_ == 0 );
+        return ( ret == TARO_OK ) ? ( int32_t )body->size() : ret;
+    }
+    return impl_->write( ( char* )body->buffer(), body->size(), ms );
 }
 
 int32_t HttpClient::send_chunk_body( DynPacketSPtr const& body )
 {
-    if ( body == nullptr || body->size() == 0 )
+    if( impl_->client_ == nullptr )
     {
-        const char* last_body = "0\r\n\r\n";
-        return impl_->client_->send( ( char* )last_body, strlen( last_body ) );
+        WS_ERROR << "connect is invalid";
+        return TARO_ERR_INVALID_RES;
     }
 
-    std::stringstream ss;
-    ss << std::hex << body->size() << HTTP_SEP;
-    if ( impl_->client_->send( ( char* )ss.str().c_str(), ss.str().length() ) < 0 )
+    bool last = ( body == nullptr || body->size() == 0 );
+    if ( impl_->deflating_ && impl_->deflate_chunked_ )
     {
-        WS_ERROR << "disconnect";
-        return TARO_ERR_DISCONNECT;
+        return impl_->send_compressed( last ? nullptr : body->buffer(), last ? 0 : body->size(), last );
     }
 
-    body->append( HTTP_SEP );
-    if ( impl_->client_->send( ( char* )body->buffer(), body->size() ) < 0 )
+    if ( last )
     {
-        WS_ERROR << "disconnect";
-        return TARO_ERR_DISCONNECT;
+        const char* last_body = "0\r\n\r\n";
+        return impl_->write( ( char* )last_body, strlen( last_body ) );
     }
-    return TARO_OK;
+
+    std::stringstream ss;
+    ss << std::hex << body->size() << HTTP_SEP;
+    return HttpClientImpl::send_framed( *impl_, ss.str(), body->buffer(), body->size(), HTTP_SEP );
 }
 
 int32_t HttpClient::send_boundary_body( DynPacketSPtr const& body, const char* boundary )
@@ -146,23 +207,97 @@ int32_t HttpClient::send_boundary_body( DynPacketSPtr const& body, const char* b
         return TARO_ERR_INVALID_ARG;
     }
 
+    if( impl_->client_ == nullptr )
+    {
+        WS_ERROR << "connect is invalid";
+        return TARO_ERR_INVALID_RES;
+    }
+
     if ( body == nullptr || body->size() == 0 )
     {
         std::stringstream ss;
         ss << "--" << boundary << "--\r\n";
-        return impl_->client_->send( ( char* )ss.str().c_str(), ss.str().length() );
+        return impl_->write( ( char* )ss.str().c_str(), ss.str().length() );
     }
 
     std::stringstream ss;
     ss << "--" << boundary << HTTP_SEP;
-    if ( impl_->client_->send( ( char* )ss.str().c_str(), ss.str().length() ) < 0 )
+    return HttpClientImpl::send_framed( *impl_, ss.str(), body->buffer(), body->size(), HTTP_SEP );
+}
+
+int32_t HttpClient::send_file( int32_t fd, uint64_t offset, uint64_t bytes, EHttpBodyMode mode, const char* boundary )
+{
+    if ( fd < 0 || ( mode == eHttpBodyBoundary && !STRING_CHECK( boundary ) ) )
     {
-        WS_ERROR << "disconnect";
-        return TARO_ERR_DISCONNECT;
+        WS_ERROR << "parameter invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+
+    if( impl_->client_ == nullptr )
+    {
+        WS_ERROR << "connect is invalid";
+        return TARO_ERR_INVALID_RES;
+    }
+
+    auto& cli = *impl_;
+    if ( mode == eHttpBodyBoundary )
+    {
+        std::string head = std::string( "--" ) + boundary + HTTP_SEP;
+        if ( cli.write( ( char* )head.c_str(), head.length() ) < 0 )
+        {
+            WS_ERROR << "disconnect";
+            return TARO_ERR_DISCONNECT;
+        }
+    }
+
+    // 读取的数据前后预留chunk长度行与结尾\r\n的空间, 组帧不需要额外拷贝
+    auto packet = create_default_packet( HTTP_CHUNK_HEAD_ROOM + HTTP_UPLOAD_BUF_SIZE + HTTP_SEP_LEN );
+    uint8_t* data = ( uint8_t* )packet->buffer() + HTTP_CHUNK_HEAD_ROOM;
+    uint64_t sent = 0;
+    while ( sent < bytes )
+    {
+        auto len = ( uint32_t )std::min<uint64_t>( HTTP_UPLOAD_BUF_SIZE, bytes - sent );
+        auto ret = read_at( fd, data, len, offset + sent );
+        if ( ret <= 0 )
+        {
+            WS_ERROR << "read file failed, offset:" << offset + sent;
+            return TARO_ERR_FAILED; // 数据体已发出一部分, 连接应当关闭
+        }
+        len = ( uint32_t )ret;
+
+        uint8_t* frame = data;
+        uint32_t frame_len = len;
+        if ( mode == eHttpBodyChunk )
+        {
+            char line[HTTP_CHUNK_HEAD_ROOM];
+            auto line_len = ( uint32_t )snprintf( line, sizeof( line ), "%x\r\n", len );
+            frame -= line_len;
+            memcpy( frame, line, line_len );
+            memcpy( data + len, HTTP_SEP, HTTP_SEP_LEN );
+            frame_len += line_len + HTTP_SEP_LEN;
+        }
+
+        if ( cli.write( ( char* )frame, frame_len ) < 0 )
+        {
+            WS_ERROR << "disconnect";
+            return TARO_ERR_DISCONNECT;
+        }
+        sent += len;
+    }
+
+    const char* tail = nullptr;
+    std::string end;
+    if ( mode == eHttpBodyChunk )
+    {
+        tail = "0\r\n\r\n";
+    }
+    else if ( mode == eHttpBodyBoundary )
+    {
+        end  = std::string( HTTP_SEP ) + "--" + boundary + "--\r\n";
+        tail = end.c_str();
     }
 
-    body->append( HTTP_SEP );
-    if ( impl_->client_->send( ( char* )body->buffer(), body->size() ) < 0 )
+    if ( tail != nullptr && cli.write( ( char* )tail, strlen( tail ) ) < 0 )
     {
         WS_ERROR << "disconnect";
         return TARO_ERR_DISCONNECT;
@@ -170,17 +305,155 @@ int32_t HttpClient::send_boundary_body( DynPacketSPtr const& body, const char* b
     return TARO_OK;
 }
 
-HttpRespRet HttpClient::recv_resp( uint32_t ms )
+int32_t HttpClient::send_file( const char* path, EHttpBodyMode mode, const char* boundary )
+{
+    if ( !STRING_CHECK( path ) )
+    {
+        WS_ERROR << "path invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+
+    uint64_t bytes = 0;
+    auto fd = open_read( path, bytes );
+    if ( fd < 0 )
+    {
+        WS_ERROR << "open file failed:" << path;
+        return TARO_ERR_FAILED;
+    }
+
+    auto ret = send_file( fd, 0, bytes, mode, boundary );
+    close_fd( fd );
+    return ret;
+}
+
+HttpRespRet HttpClientImpl::recv_resp( HttpClient& client, Deadline const& dl, bool slice )
+{
+    auto impl = client.impl_;
+    while ( 1 )
+    {
+        auto result = recv_raw( client, dl, slice );
+        if ( result.ret != TARO_OK || result.resp == nullptr || !impl->decode_ )
+        {
+            return result;
+        }
+
+        // 同一回复的chunk与分段共用一个HttpResponse, 新回复重新判断编码
+        if ( result.resp != impl->decode_resp_ )
+        {
+            auto encoding = result.resp->get<std::string>( "Content-Encoding" );
+            impl->decode_resp_ = result.resp;
+            impl->inflating_   = encoding.valid()
+                              && HttpInflater::supported( encoding.value() )
+                              && impl->inflater_.begin( impl->decode_limit_ );
+            if ( impl->inflating_ )
+            {
+                // 返回的数据体已解压, 去掉描述压缩数据的回复头
+                result.resp->remove( "Content-Encoding" );
+                result.resp->remove( "Content-Length" );
+            }
+        }
+
+        bool last = ( impl->parser_.type() == HttpProtoPaser::TYPE_INVALID );
+        if ( impl->inflating_ && result.body != nullptr )
+        {
+            DynPacketSPtr out;
+            auto ret = impl->inflater_.feed( result.body->buffer(), result.body->size(), out );
+            if ( ret != TARO_OK )
+            {
+                if ( !last )
+                {
+                    poison( client );
+                }
+                impl->decode_resp_.reset();
+                result.ret = ret;
+                result.body.reset();
+                return result;
+            }
+
+            result.body = out;
+            if ( out == nullptr && !last )
+            {
+                continue; // 暂无解压输出, 继续接收, 避免返回nullptr被误认为结束
+            }
+        }
+
+        if ( last )
+        {
+            bool truncated = impl->inflating_ && !impl->inflater_.finished();
+            impl->decode_resp_.reset();
+            impl->inflater_.end();
+            if ( truncated )
+            {
+                // 回复已完整接收, 连接可以复用, 但压缩流没有结束, 数据体不完整
+                WS_ERROR << "compressed body truncated";
+                result.ret = TARO_ERR_FORMAT;
+                result.body.reset();
+            }
+        }
+        return result;
+    }
+}
+
+int32_t HttpClientImpl::wait_continue( HttpClient& client, Deadline const& dl )
+{
+    auto impl = client.impl_;
+    while ( 1 )
+    {
+        if ( TARO_OK == impl->parser_.parse_header() )
+        {
+            if ( !interim( impl->parser_.get_header() ) )
+            {
+                WS_WARN << "request rejected before body";
+                return TARO_ERR_FAILED;
+            }
+            impl->parser_.reset();
+            return TARO_OK;
+        }
+
+        auto packet = create_default_packet( 1024 );
+        auto ret = impl->client_->recv( ( char* )packet->buffer(), packet->capcity(), dl.remain() );
+        if ( ret == TARO_ERR_TIMEOUT || ( ret <= 0 && dl.expired() ) )
+        {
+            return TARO_OK; // 服务端可能不支持100-continue, 继续发送数据体
+        }
+
+        if ( ret < 0 )
+        {
+            if ( ret == TARO_ERR_CONTINUE )
+            {
+                continue;
+            }
+            set_errno( ret );
+            return TARO_ERR_DISCONNECT;
+        }
+        packet->resize( ret );
+        impl->parser_.push( packet );
+    }
+}
+
+HttpRespRet HttpClientImpl::recv_raw( HttpClient& client, Deadline const& dl, bool slice )
 {
     constexpr uint32_t default_pack_size = 1024;
+    auto impl = client.impl_;
+    HttpRespRet result;
+    result.ret = TARO_ERR_FAILED;
     auto recv_func = [&]()
     {
-        auto packet = create_default_packet( default_pack_size );
-        TARO_ASSERT( impl_->client_, "connection is nullptr" );
+        auto packet = create_default_packet( slice ? HTTP_SLICE_PACK_SIZE : default_pack_size );
+        TARO_ASSERT( impl->client_, "connection is nullptr" );
 
         while( 1 )
         {
-            auto ret = impl_->client_->recv( ( char* )packet->buffer(), packet->capcity(), ms );
+            auto ret = impl->client_->recv( ( char* )packet->buffer(), packet->capcity(), dl.remain() );
+            if ( ret == TARO_ERR_TIMEOUT || ( ret <= 0 && dl.expired() ) )
+            {
+                // 回复未读完, 连接上的数据已无法对齐
+                WS_ERROR << "receive response timeout";
+                poison( client );
+                result.ret = TARO_ERR_TIMEOUT;
+                return false;
+            }
+
             if( ret < 0 )
             {
                 if( ret == TARO_ERR_CONTINUE )
@@ -188,88 +461,130 @@ HttpRespRet HttpClient::recv_resp( uint32_t ms )
                     continue;
                 }
                 set_errno( ret );
+                result.ret = TARO_ERR_DISCONNECT;
                 return false;
             }
             packet->resize( ret );
-            impl_->parser_.push( packet );
+            impl->parser_.push( packet );
             break;
         }
         return true;
     };
 
-    HttpRespRet result;
-    result.ret = TARO_ERR_FAILED;
     while( 1 )
     {
-        if ( ( HttpProtoPaser::TYPE_INVALID == impl_->parser_.type() )
-        &&   ( TARO_OK != impl_->parser_.parse_header() ) )
+        if ( ( HttpProtoPaser::TYPE_INVALID == impl->parser_.type() )
+        &&   ( TARO_OK != impl->parser_.parse_header() ) )
         {
             if ( !recv_func() )
             {
-                result.ret = TARO_ERR_DISCONNECT;
                 return result;
             }
             continue;
         }
 
-        auto type = impl_->parser_.type();
-        if ( HttpProtoPaser::TYPE_NORMAL == type )
+        if ( impl->resp_ == nullptr && interim( impl->parser_.get_header() ) )
+        {
+            impl->parser_.reset(); // 跳过超时后才到达的100 Continue等临时回复
+            continue;
+        }
+
+        auto type = impl->parser_.type();
+        if ( HttpProtoPaser::TYPE_NORMAL == type && !slice )
         {
             DynPacketSPtr body;
-            if ( TARO_ERR_CONTINUE == impl_->parser_.get_content( body ) )
+            auto ret = impl->parser_.get_content( body );
+            if ( TARO_ERR_CONTINUE == ret )
             {
                 if ( !recv_func() )
                 {
-                    result.ret = TARO_ERR_DISCONNECT;
                     return result;
                 }
                 continue;
             }
+            else if ( ret != TARO_OK )
+            {
+                poison( client );
+                result.ret = TARO_ERR_FORMAT;
+                return result;
+            }
 
             auto resp = std::make_shared<HttpResponse>();
-            if ( !HttpResponseImpl::deserialize( *resp, impl_->parser_.get_header() ) )
+            if ( !HttpResponseImpl::deserialize( *resp, impl->parser_.get_header() ) )
             {
                 result.ret = TARO_ERR_FORMAT;
                 return result;
             }
 
+            if ( resp->equal( "Connection", "close" ) )
+            {
+                impl->keep_alive_ = false;
+            }
+
             result.body = body;
             result.resp = resp;
             result.ret  = TARO_OK;
-            impl_->parser_.reset();
-            impl_->resp_.reset();
+            impl->parser_.reset();
+            impl->resp_.reset();
             return result;
         }
 
-        if ( impl_->resp_ == nullptr )
+        if ( impl->resp_ == nullptr )
         {
             auto resp = std::make_shared<HttpResponse>();
-            if ( !HttpResponseImpl::deserialize( *resp, impl_->parser_.get_header() ) )
+            if ( !HttpResponseImpl::deserialize( *resp, impl->parser_.get_header() ) )
             {
                 result.ret = TARO_ERR_FORMAT;
                 return result;
             }
-            impl_->resp_ = resp;
+
+            if ( resp->equal( "Connection", "close" ) )
+            {
+                impl->keep_alive_ = false;
+            }
+            impl->resp_ = resp;
         }
 
         if( HttpProtoPaser::TYPE_WEBSOCKET == type )
         {
-            result.resp = impl_->resp_;
+            result.resp = impl->resp_;
+            result.ret  = TARO_OK;
+            impl->parser_.reset();
+            impl->resp_.reset();
+            return result;
+        }
+
+        if ( HttpProtoPaser::TYPE_NORMAL == type )
+        {
+            DynPacketSPtr body;
+            if ( TARO_ERR_CONTINUE == impl->parser_.get_content_slice( body ) )
+            {
+                if ( !recv_func() )
+                {
+                    return result;
+                }
+                continue;
+            }
+
+            result.body = body;
+            result.resp = impl->resp_;
             result.ret  = TARO_OK;
-            impl_->parser_.reset();
-            impl_->resp_.reset();
+            if( body == nullptr )
+            {
+                impl->parser_.reset();
+                impl->resp_.reset();
+            }
             return result;
         }
 
         if ( HttpProtoPaser::TYPE_CHUNK == type )
         {
             DynPacketSPtr body;
-            auto ret = impl_->parser_.get_chunk( body );
+            auto ret = impl->parser_.get_chunk( body, slice );
             if ( TARO_ERR_CONTINUE == ret )
             {
                 if ( !recv_func() )
                 {
-                    result.ret = TARO_ERR_DISCONNECT;
                     return result;
                 }
                 continue;
@@ -281,12 +596,12 @@ HttpRespRet HttpClient::recv_resp( uint32_t ms )
             }
 
             result.body = body;
-            result.resp = impl_->resp_;
+            result.resp = impl->resp_;
             result.ret  = TARO_OK;
             if( body == nullptr )
             {
-                impl_->parser_.reset();
-                impl_->resp_.reset();
+                impl->parser_.reset();
+                impl->resp_.reset();
             }
             return result;
         }
@@ -294,22 +609,21 @@ HttpRespRet HttpClient::recv_resp( uint32_t ms )
         if ( HttpProtoPaser::TYPE_BOUNDARY == type )
         {
             DynPacketSPtr body;
-            if ( TARO_ERR_CONTINUE == impl_->parser_.get_boundary( body ) )
+            if ( TARO_ERR_CONTINUE == impl->parser_.get_boundary( body ) )
             {
                 if ( !recv_func() )
                 {
-                    result.ret = TARO_ERR_DISCONNECT;
                     return result;
                 }
                 continue;
             }
             result.body = body;
-            result.resp = impl_->resp_;
+            result.resp = impl->resp_;
             result.ret  = TARO_OK;
             if( body == nullptr )
             {
-                impl_->parser_.reset();
-                impl_->resp_.reset();
+                impl->parser_.reset();
+                impl->resp_.reset();
             }
         }
         return result;
@@ -317,9 +631,110 @@ HttpRespRet HttpClient::recv_resp( uint32_t ms )
     return HttpRespRet();
 }
 
+HttpRespRet HttpClientImpl::recv_sink( HttpClient& client, HttpSinkFunc const& sink, Deadline const& dl )
+{
+    while ( 1 )
+    {
+        auto result = recv_resp( client, dl, true );
+        if ( result.ret != TARO_OK )
+        {
+            return result;
+        }
+
+        auto body = result.body;
+        result.body.reset();
+        if ( body != nullptr )
+        {
+            auto ret = sink( body->buffer(), body->size() );
+            if ( ret != TARO_OK )
+            {
+                WS_ERROR << "sink abort, ret:" << ret;
+                poison( client ); // 回复未读完, 连接不可复用
+                result.ret = ret;
+                return result;
+            }
+        }
+
+        if ( client.impl_->parser_.type() == HttpProtoPaser::TYPE_INVALID )
+        {
+            return result;
+        }
+    }
+}
+
+HttpRespRet HttpClient::recv_resp( uint32_t ms )
+{
+    return HttpClientImpl::recv_resp( *this, Deadline( ms ) );
+}
+
+HttpRespRet HttpClient::recv_stream( HttpSinkFunc const& sink, uint32_t ms )
+{
+    if ( !sink || impl_->client_ == nullptr )
+    {
+        WS_ERROR << "parameter invalid";
+        HttpRespRet result;
+        result.ret = TARO_ERR_INVALID_ARG;
+        return result;
+    }
+    return HttpClientImpl::recv_sink( *this, sink, Deadline( ms ) );
+}
+
+HttpRespRet HttpClient::recv_file( int32_t fd, uint32_t ms )
+{
+    if ( fd < 0 )
+    {
+        WS_ERROR << "fd invalid";
+        HttpRespRet result;
+        result.ret = TARO_ERR_INVALID_ARG;
+        return result;
+    }
+
+    return recv_stream( [fd]( uint8_t const* data, uint32_t bytes ) -> int32_t
+    {
+        while ( bytes > 0 )
+        {
+            auto ret = write_fd( fd, data, bytes );
+            if ( ret <= 0 )
+            {
+                WS_ERROR << "write file failed";
+                return TARO_ERR_FAILED;
+            }
+            data  += ret;
+            bytes -= ( uint32_t )ret;
+        }
+        return TARO_OK;
+    }, ms );
+}
+
+HttpRespRet HttpClient::recv_buffer( uint8_t* buffer, uint64_t& bytes, uint32_t ms )
+{
+    if ( buffer == nullptr || bytes == 0 )
+    {
+        WS_ERROR << "buffer invalid";
+        HttpRespRet result;
+        result.ret = TARO_ERR_INVALID_ARG;
+        return result;
+    }
+
+    uint64_t capacity = bytes;
+    bytes = 0;
+    return recv_stream( [&]( uint8_t const* data, uint32_t len ) -> int32_t
+    {
+        if ( bytes + len > capacity )
+        {
+            WS_ERROR << "buffer too small, capacity:" << capacity;
+            return TARO_ERR_INVALID_ARG;
+        }
+        memcpy( buffer + bytes, data, len );
+        bytes += len;
+        return TARO_OK;
+    }, ms );
+}
+
 HttpRespRet HttpClient::request( HttpRequest const& request, uint32_t ms )
 {
-    auto ret = send_req( request );
+    Deadline dl( ms );
+    auto ret = send_req( request, dl.remain() );
     if ( ret <= 0 )
     {
         WS_ERROR << "send request failed";
@@ -327,7 +742,103 @@ HttpRespRet HttpClient::request( HttpRequest const& request, uint32_t ms )
         result.ret = ret;
         return result;
     }
-    return recv_resp( ms );
+    return HttpClientImpl::recv_resp( *this, dl );
+}
+
+std::vector<HttpRespRet> HttpClient::pipeline( std::vector<HttpPipeReq> const& reqs, uint32_t window, uint32_t ms )
+{
+    Deadline dl( ms );
+    HttpRespRet failed;
+    failed.ret = TARO_ERR_DISCONNECT;
+    std::vector<HttpRespRet> results( reqs.size(), failed );
+
+    if ( impl_->client_ == nullptr || window == 0 )
+    {
+        WS_ERROR << "connect is invalid or window is zero";
+        return results;
+    }
+
+    if ( !idle() )
+    {
+        WS_ERROR << "previous response not finished";
+        return results;
+    }
+
+    for ( auto const& one : reqs )
+    {
+        if ( one.req == nullptr || !one.req->valid() )
+        {
+            WS_ERROR << "http request is invalid";
+            for ( auto& ret : results )
+            {
+                ret.ret = TARO_ERR_INVALID_ARG;
+            }
+            return results;
+        }
+    }
+
+    size_t sent = 0, done = 0;
+    std::string buffer;
+    while ( done < reqs.size() )
+    {
+        // 在途请求降到窗口一半时补满窗口, 保证每次写入都合并多个请求
+        if ( sent < reqs.size() && sent - done <= window / 2 )
+        {
+            buffer.clear();
+            size_t end = std::min( reqs.size(), done + window );
+            for ( ; sent < end; ++sent )
+            {
+                auto const& body = reqs[sent].body;
+                uint32_t body_bytes = ( body == nullptr ) ? 0 : body->size();
+                buffer += HttpRequestImpl::serialize( *reqs[sent].req, body_bytes );
+                if ( body_bytes > 0 )
+                {
+                    buffer.append( ( char* )body->buffer(), body_bytes );
+                }
+            }
+
+            if ( impl_->write( ( char* )buffer.c_str(), buffer.length() ) <= 0 )
+            {
+                WS_ERROR << "send pipeline requests failed";
+                impl_->keep_alive_ = false;
+                return results;
+            }
+        }
+
+        results[done] = HttpClientImpl::recv_whole( *this, dl );
+        if ( results[done].ret != TARO_OK )
+        {
+            WS_ERROR << "recv pipeline response failed index:" << done;
+            impl_->keep_alive_ = false; // 回复顺序已无法保证, 连接不可复用
+            return results;
+        }
+        ++done;
+
+        if ( !impl_->keep_alive_ )
+        {
+            if ( done < reqs.size() )
+            {
+                WS_WARN << "connection closed by peer, " << reqs.size() - done << " requests unanswered";
+            }
+            break;
+        }
+    }
+    return results;
+}
+
+void HttpClient::set_decode( bool enable, uint64_t max_bytes )
+{
+    impl_->decode_       = enable;
+    impl_->decode_limit_ = max_bytes;
+}
+
+bool HttpClient::idle() const
+{
+    return impl_->client_ != nullptr
+        && impl_->keep_alive_
+        && impl_->resp_ == nullptr
+        && impl_->parser_.type() == HttpProtoPaser::TYPE_INVALID
+        && impl_->parser_.rest_bytes() == 0;
 }
 
 NAMESPACE_TARO_WS_END
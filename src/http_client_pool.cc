@@ -0,0 +1,334 @@
+﻿
+#include "impl/http_client_pool_impl.h"
+#include <co_routine/inc.h>
+
+NAMESPACE_TARO_WS_BEGIN
+
+HttpClientPool::HttpClientPool( HttpPoolOpt const& opt )
+    : impl_( new HttpClientPoolImpl )
+{
+    TARO_ASSERT( opt.max_per_host > 0 && opt.min_idle <= opt.max_per_host );
+    impl_->opt_ = opt;
+    impl_->tokens_ = impl_->hedge_opt_.budget_burst;
+    impl_->latency_pos_ = 0;
+    impl_->last_evict_ = 0;
+}
+
+HttpClientPool::~HttpClientPool()
+{
+    delete impl_;
+}
+
+HttpClientSPtr HttpClientPool::acquire( const char* host, uint16_t port, net::SSLContext* ctx, uint32_t ms )
+{
+    if ( !STRING_CHECK( host ) )
+    {
+        WS_ERROR << "host invalid";
+        return nullptr;
+    }
+
+    auto key   = HttpClientPoolImpl::make_key( host, port, ctx );
+    Deadline dl( ms );
+    auto drop  = [&]()
+    {
+        {
+            std::lock_guard<std::mutex> lock( impl_->mutex_ );
+            --impl_->hosts_[key].total;
+        }
+        impl_->slot_event_.notify();
+    };
+
+    while( 1 )
+    {
+        auto seen = impl_->slot_event_.generation();
+        HttpClientSPtr reuse;
+        bool create = false;
+        bool check  = false;
+        std::list<HttpPoolItem> evicted;
+        {
+            std::lock_guard<std::mutex> lock( impl_->mutex_ );
+            impl_->evict_locked( SystemTime::current_ms(), false, evicted );
+            auto& pool = impl_->hosts_[key];
+            if ( !pool.idle.empty() )
+            {
+                auto const& item = pool.idle.back();
+                reuse = item.client;
+                check = ( SystemTime::current_ms() - item.idle_since >= impl_->opt_.check_idle_ms );
+                pool.idle.pop_back();
+            }
+            else if ( pool.total < impl_->opt_.max_per_host )
+            {
+                ++pool.total;
+                create = true;
+            }
+        }
+
+        if ( reuse != nullptr )
+        {
+            if ( !check || HttpClientPoolImpl::healthy( reuse ) )
+            {
+                return reuse;
+            }
+            WS_WARN << "drop unhealthy connection " << key;
+            drop();
+            continue;
+        }
+
+        if ( create )
+        {
+            auto client = std::make_shared<HttpClient>( ctx );
+            if ( client->connect( host, port, dl.remain() ) != TARO_OK )
+            {
+                drop();
+                return nullptr;
+            }
+            HttpClientImpl::get( *client )->pool_key_ = key;
+            return client;
+        }
+
+        if ( dl.expired() )
+        {
+            WS_ERROR << "acquire connection timeout " << key;
+            return nullptr;
+        }
+        impl_->slot_event_.wait( seen, dl.remain() );
+    }
+}
+
+void HttpClientPool::release( HttpClientSPtr const& client )
+{
+    if ( client == nullptr )
+    {
+        return;
+    }
+
+    auto const& key = HttpClientImpl::get( *client )->pool_key_;
+    if ( key.empty() )
+    {
+        WS_ERROR << "connection not belong to pool";
+        return;
+    }
+
+    std::list<HttpPoolItem> evicted;
+    {
+        std::lock_guard<std::mutex> lock( impl_->mutex_ );
+        auto it = impl_->hosts_.find( key );
+        TARO_ASSERT( it != impl_->hosts_.end() && it->second.total > 0 );
+        uint64_t now = SystemTime::current_ms();
+        if ( client->idle() )
+        {
+            it->second.idle.emplace_back( HttpPoolItem{ client, now } );
+        }
+        else
+        {
+            --it->second.total; // 回复未读完的连接无法复用
+        }
+        impl_->evict_locked( now, false, evicted );
+    }
+    impl_->slot_event_.notify();
+}
+
+uint32_t HttpClientPool::evict()
+{
+    std::list<HttpPoolItem> evicted;
+    std::lock_guard<std::mutex> lock( impl_->mutex_ );
+    return impl_->evict_locked( SystemTime::current_ms(), true, evicted );
+}
+
+std::vector<HttpBatchRet> HttpClientPool::scatter( std::vector<HttpBatchReq> const& reqs, HttpBatchOpt const& opt, HttpBatchCallback const& on_ret )
+{
+    uint32_t total  = ( uint32_t )reqs.size();
+    uint32_t target = ( opt.wait_count == 0 || opt.wait_count > total ) ? total : opt.wait_count;
+    Deadline deadline( opt.deadline_ms );
+
+    auto state = std::make_shared<HttpBatchState>();
+    state->rets.reserve( total );
+    for ( uint32_t i = 0; i < total; ++i )
+    {
+        if ( reqs[i].req == nullptr )
+        {
+            // 无效的请求直接作为结果返回, 同样计入等待的数量
+            WS_ERROR << "request invalid index:" << i;
+            HttpBatchRet ret;
+            ret.index      = i;
+            ret.result.ret = TARO_ERR_INVALID_ARG;
+            state->rets.push_back( ret );
+        }
+    }
+
+    for ( uint32_t i = 0; i < total; ++i )
+    {
+        if ( reqs[i].req == nullptr )
+        {
+            continue;
+        }
+
+        auto item = reqs[i];
+        co_run [this, state, item, i, deadline]()
+        {
+            HttpBatchRet ret;
+            ret.index  = i;
+            ret.result = HttpClientPoolImpl::request( *this, item, deadline );
+            {
+                std::lock_guard<std::mutex> lock( state->mutex );
+                if ( !state->active )
+                {
+                    return; // 批量请求已返回
+                }
+                state->rets.push_back( ret );
+            }
+            state->event.notify();
+        }, opt_name( "http_scatter" );
+    }
+
+    // 回调在调用方的协程中按完成顺序执行, 不持有锁, 返回之后不会再调用
+    size_t reported = 0;
+    std::vector<HttpBatchRet> fresh;
+    while( 1 )
+    {
+        auto seen   = state->event.generation();
+        bool finish = false;
+        {
+            std::lock_guard<std::mutex> lock( state->mutex );
+            fresh.assign( state->rets.begin() + reported, state->rets.end() );
+            reported = state->rets.size();
+            finish   = ( reported >= target || deadline.expired() );
+            if ( finish )
+            {
+                state->active = false;
+            }
+        }
+
+        if ( on_ret )
+        {
+            for ( auto const& one : fresh )
+            {
+                on_ret( one );
+            }
+        }
+
+        if ( finish )
+        {
+            std::lock_guard<std::mutex> lock( state->mutex );
+            return std::move( state->rets );
+        }
+        state->event.wait( seen, deadline.remain() );
+    }
+}
+
+void HttpClientPool::set_hedge( HttpHedgeOpt const& opt )
+{
+    TARO_ASSERT( opt.max_attempts > 0 && opt.budget_ratio >= 0 );
+    std::lock_guard<std::mutex> lock( impl_->hedge_mutex_ );
+    impl_->hedge_opt_ = opt;
+    impl_->tokens_ = std::min<double>( impl_->tokens_, opt.budget_burst );
+}
+
+HttpRespRet HttpClientPool::hedge( std::vector<HttpBatchReq> const& replicas, uint32_t ms )
+{
+    HttpRespRet result;
+    result.ret = TARO_ERR_INVALID_ARG;
+    if ( replicas.empty() || replicas[0].req == nullptr )
+    {
+        WS_ERROR << "request invalid";
+        return result;
+    }
+
+    uint32_t max_attempts = 1;
+    if ( HttpClientPoolImpl::idempotent( replicas[0].req->method() ) )
+    {
+        std::lock_guard<std::mutex> lock( impl_->hedge_mutex_ );
+        max_attempts = impl_->hedge_opt_.max_attempts;
+    }
+
+    uint32_t delay    = impl_->hedge_delay();
+    Deadline deadline( ms );
+    uint64_t last     = 0;
+    uint32_t attempts = 0;
+    auto state = std::make_shared<HttpHedgeState>();
+    auto launch = [&]()
+    {
+        auto const& item = replicas[attempts % replicas.size()];
+        ++attempts;
+        last = SystemTime::current_ms();
+        co_run [this, state, item, deadline]()
+        {
+            impl_->attempt( *this, state, item, deadline );
+        }, opt_name( "http_hedge" );
+    };
+
+    state->running = 1;
+    launch();
+    bool hedging = true;
+    while( 1 )
+    {
+        auto seen     = state->event.generation();
+        bool next     = false;
+        uint32_t wait = 0;
+        {
+            std::lock_guard<std::mutex> lock( state->mutex );
+            if ( state->done )
+            {
+                return state->result;
+            }
+
+            uint64_t now = SystemTime::current_ms();
+            if ( deadline.expired() )
+            {
+                HttpClientPoolImpl::finish( *state );
+                result.ret = TARO_ERR_TIMEOUT;
+                return result;
+            }
+
+            // 全部失败时重试, 超过对冲延时未回复时对冲, 两者都受重试令牌限制
+            bool retry = ( state->running == 0 );
+            bool hedge = !retry && hedging && ( now - last >= delay );
+            next = ( retry || hedge ) && attempts < max_attempts && impl_->take_token();
+            if ( retry && !next )
+            {
+                return state->result;
+            }
+
+            if ( next )
+            {
+                ++state->running;
+            }
+            else if ( hedge )
+            {
+                hedging = false; // 令牌不足时不再对冲, 只等待进行中的尝试
+            }
+            else if ( hedging && attempts < max_attempts )
+            {
+                wait = ( uint32_t )( last + delay - now );
+            }
+        }
+
+        if ( next )
+        {
+            launch();
+            continue;
+        }
+
+        // 等待任一尝试结束, 到达下一次对冲的时间或截止时间
+        // 尝试结束后的恢复延迟直接计入请求耗时, 等待间隔不退避
+        uint32_t remain = deadline.remain();
+        if ( remain > 0 && ( wait == 0 || remain < wait ) )
+        {
+            wait = remain;
+        }
+        state->event.wait( seen, wait, CO_EVENT_MIN_STEP );
+    }
+}
+
+uint32_t HttpClientPool::idle_count() const
+{
+    uint32_t count = 0;
+    std::lock_guard<std::mutex> lock( impl_->mutex_ );
+    for ( auto const& one : impl_->hosts_ )
+    {
+        count += ( uint32_t )one.second.idle.size();
+    }
+    return count;
+}
+
+NAMESPACE_TARO_WS_END
@@ -108,6 +108,26 @@ bool HttpRequest::contains( const char* key )
     return it != impl_->body_items_.end();
 }
 
+bool HttpRequest::remove( const char* key )
+{
+    if ( !STRING_CHECK( key ) )
+    {
+        return false;
+    }
+
+    auto it = std::find_if( impl_->body_items_.begin(), impl_->body_items_.end(), [&]( BodyItem const& item )
+    {
+        return string_compare( item.key, key );
+    } );
+
+    if ( it == impl_->body_items_.end() )
+    {
+        return false;
+    }
+    impl_->body_items_.erase( it );
+    return true;
+}
+
 void HttpRequest::set_str( const char* key, const char* value )
 {
     TARO_ASSERT( STRING_CHECK( key, value ) );
@@ -240,6 +260,26 @@ bool HttpResponse::contains( const char* key )
     return it != impl_->body_items_.end();
 }
 
+bool HttpResponse::remove( const char* key )
+{
+    if ( !STRING_CHECK( key ) )
+    {
+        return false;
+    }
+
+    auto it = std::find_if( impl_->body_items_.begin(), impl_->body_items_.end(), [&]( BodyItem const& item )
+    {
+        return string_compare( item.key, key );
+    } );
+
+    if ( it == impl_->body_items_.end() )
+    {
+        return false;
+    }
+    impl_->body_items_.erase( it );
+    return true;
+}
+
 void HttpResponse::set_str( const char* key, const char* value )
 {
     TARO_ASSERT( STRING_CHECK( key, value ) );
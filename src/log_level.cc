@@ -0,0 +1,19 @@
+﻿
+#include "defs.h"
+#include <algorithm>
+
+NAMESPACE_TARO_WS_BEGIN
+
+static std::atomic<int32_t> g_log_level( std::min( WS_LOG_LEVEL_DEFAULT, WS_LOG_LEVEL ) );
+
+void set_log_level( int32_t level )
+{
+    g_log_level = std::max( std::min( level, ( int32_t )WS_LOG_LEVEL ), ( int32_t )WS_LOG_LEVEL_FATAL );
+}
+
+int32_t log_level()
+{
+    return g_log_level.load( std::memory_order_relaxed );
+}
+
+NAMESPACE_TARO_WS_END
@@ -4,6 +4,8 @@
 #include "impl/web_server_impl.h"
 #include "impl/http_proto_impl.h"
 #include "impl/http_client_impl.h"
+#include "impl/http_inflater.h"
+#include "impl/co_event.h"
 #include <co_routine/inc.h>
 #include <base/utils/string_tool.h>
 
@@ -17,14 +19,39 @@ PUBLIC: // 公共函数
     /**
      * @brief 构造函数
     */
-    MsgHandler( net::TcpClientSPtr const& client, WebServerImpl* impl )
-        : impl_( impl )
+    MsgHandler( net::TcpClientSPtr const& client, WebServerImpl* impl, std::string const& key, uint64_t conn_id )
+        : inflating_( false )
+        , admitted_( false )
+        , ws_in_msg_( false )
+        , ws_dropping_( false )
+        , route_inflight_( nullptr )
+        , route_metrics_( nullptr )
+        , status_( 0 )
+        , req_begin_ns_( 0 )
+        , handler_ns_( 0 )
+        , req_bytes_in_( 0 )
+        , conn_id_( conn_id )
+        , requests_( 0 )
+        , total_in_( 0 )
+        , body_recv_( 0 )
+        , impl_( impl )
+        , key_( key )
         , client_( client )
         , msg_handler_( std::bind( &MsgHandler::on_http_recv, this ) )
     {
 
     }
 
+    /**
+     * @brief 析构函数
+    */
+    ~MsgHandler()
+    {
+        log_access();
+        leave();
+        WS_PROBE( close, eTraceClose, conn_id_, requests_, total_in_ );
+    }
+
     /**
      * @brief 消息处理函数
     */
@@ -44,6 +71,13 @@ PRIVATE: // 私有函数
         auto ret = client_->recv( ( char* )packet->buffer(), packet->capcity() );
         if( ret > 0 )
         {
+            req_bytes_in_ += ( uint64_t )ret;
+            total_in_     += ( uint64_t )ret;
+            if ( impl_->metrics_ != nullptr )
+            {
+                impl_->metrics_->add( HttpMetrics::eBytesIn, ( uint64_t )ret );
+            }
+
             packet->resize( ret );
             if( !on_http_arrived( packet ) )
             {
@@ -56,7 +90,7 @@ PRIVATE: // 私有函数
         }
         else
         {
-            WS_ERROR << "client disconnect";
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "client disconnect";
             return false;
         }
         return true;
@@ -68,12 +102,19 @@ PRIVATE: // 私有函数
     bool on_http_arrived( DynPacketSPtr const& packet )
     {
         parser_.push( packet );
+        if ( req_begin_ns_ == 0 && impl_->access_log_ != nullptr )
+        {
+            req_begin_ns_ = metric_now_ns();
+        }
+
+        uint64_t parse_begin = 0;
         if ( HttpProtoPaser::TYPE_INVALID == parser_.type() )
         {
+            parse_begin = ( impl_->metrics_ != nullptr ) ? metric_now_ns() : 0;
             auto ret = parser_.parse_header();
             if ( ret == TARO_ERR_INVALID_ARG )
             {
-                WS_ERROR << "parse http request header failed";
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "parse http request header failed";
                 return false; 
             }
             else if ( ret == TARO_ERR_CONTINUE )
@@ -87,25 +128,78 @@ PRIVATE: // 私有函数
             header_ = std::make_shared<HttpRequest>();
             if ( !HttpRequestImpl::deserialize( *header_, parser_.get_header() ) )
             {
-                WS_ERROR << "deserialize http request failed";
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "deserialize http request failed";
                 return false; 
             }
 
-            if( !find_handler() )
+            if ( parse_begin != 0 )
+            {
+                impl_->metrics_->parse_ns.record( metric_now_ns() - parse_begin );
+            }
+            WS_PROBE( header, eTraceHeader, conn_id_, parser_.type(), parser_.body_bytes() );
+
+            if ( !impl_->limiter_.allow_req( key_, header_ ) )
+            {
+                count_status( eHttpRespCodeTooMany );
+                auto const& resp = impl_->limiter_.reject();
+                client_->send( ( char* )resp.c_str(), ( uint32_t )resp.length() );
+                return false;
+            }
+
+            bool found = find_handler();
+            WS_PROBE( route, eTraceRoute, conn_id_, found, 0 );
+            if( !found )
             {
                 notfound_repsonse();
                 clear();
                 return false;
             }
+
+            if ( HttpProtoPaser::TYPE_WEBSOCKET != parser_.type() && !admit() )
+            {
+                return false;
+            }
+
+            if ( impl_->decode_ )
+            {
+                auto encoding = header_->get<std::string>( "Content-Encoding" );
+                inflating_ = encoding.valid()
+                          && HttpInflater::supported( encoding.value() )
+                          && inflater_.begin( impl_->decode_limit_ );
+            }
+
+            if ( HttpProtoPaser::TYPE_NORMAL == parser_.type() && !check_limit( parser_.body_bytes() ) )
+            {
+                return false; // 数据体未读取, 直接断开
+            }
+
+            if ( HttpProtoPaser::TYPE_WEBSOCKET != parser_.type() && !pre_check() )
+            {
+                return false;
+            }
+
+            if ( inflating_ )
+            {
+                // 处理函数收到的数据体已解压, 去掉描述压缩数据的请求头
+                header_->remove( "Content-Encoding" );
+                header_->remove( "Content-Length" );
+            }
         }
 
         auto type = parser_.type();
-        if ( HttpProtoPaser::TYPE_NORMAL == type )
+        if ( HttpProtoPaser::TYPE_NORMAL == type && ( opt_.stream_body || buffer_handler_ ) )
+        {
+            return on_content_slice();
+        }
+        else if ( HttpProtoPaser::TYPE_NORMAL == type )
         {
             DynPacketSPtr content;
-            if ( TARO_ERR_CONTINUE == parser_.get_content( content ) )
+            auto ret = parser_.get_content( content );
+            if ( TARO_ERR_CONTINUE == ret )
                 return true;
-            if( !handler_( HttpClientImpl::create( client_ ), header_, content ) )
+            if ( TARO_OK != ret || !decode( content ) )
+                return false;
+            if( !call( content ) )
                 return false;
             clear();
         }
@@ -115,7 +209,7 @@ PRIVATE: // 私有函数
         }
         else if( HttpProtoPaser::TYPE_BOUNDARY == type )
         {
-            return on_boundary_msg();
+            return buffer_handler_ ? on_boundary_buffer() : on_boundary_msg();
         }
         else if( HttpProtoPaser::TYPE_WEBSOCKET == type )
         {
@@ -134,17 +228,44 @@ PRIVATE: // 私有函数
     bool on_ws_recv()
     {
         WsRecvData result;
-        auto ret = WsClientImpl::recv_ws( client_, result.body, result.last_pack, result.kind, result.evt );
+        auto ret = WsClientImpl::recv_ws( *ws_session_, result.body, result.last_pack, result.kind, result.evt );
         if ( ret < 0 )
         {
-            WS_ERROR << "receive websocket failed";
+            if ( ws_session_->dead_ )
+            {
+                // 心跳超时, 连接已由recv_ws关闭, 在连接协程中通知
+                result.evt = eWsEventTimeout;
+                impl_->ws_handler_( WsClientImpl::create( ws_session_ ), result );
+                return false;
+            }
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "receive websocket failed";
             return false;
         }
 
+        if ( impl_->metrics_ != nullptr )
+        {
+            impl_->metrics_->add( HttpMetrics::eWsFramesIn );
+        }
+        WS_PROBE( ws_recv, eTraceWsRecv, conn_id_, ( result.body != nullptr ) ? result.body->size() : 0, result.kind );
+
+        // 按消息限速, 消息的首帧取令牌, 其余分片随首帧一起投递或丢弃, 关闭事件不限速
+        if ( result.evt != eWsEventClose )
+        {
+            if ( !ws_in_msg_ )
+            {
+                ws_dropping_ = !impl_->limiter_.allow_ws( key_ );
+            }
+            ws_in_msg_ = !result.last_pack;
+            if ( ws_dropping_ )
+            {
+                return true; // 超过限速的消息直接丢弃
+            }
+        }
+
         if ( impl_->ws_handler_ )
         {
             result.ret = TARO_OK;
-            impl_->ws_handler_( WsClientImpl::create( client_ ), result );
+            impl_->ws_handler_( WsClientImpl::create( ws_session_ ), result );
         }
         return true;
     }
@@ -154,9 +275,427 @@ PRIVATE: // 私有函数
     */
     void clear()
     {
+        log_access();
         header_.reset();
         handler_ = nullptr;
         parser_.reset();
+        inflating_ = false;
+        inflater_.end();
+        body_recv_ = 0;
+        body_.reset();
+        conn_.reset();
+        status_       = 0;
+        req_begin_ns_ = 0;
+        handler_ns_   = 0;
+        req_bytes_in_ = 0;
+        leave();
+    }
+
+    /**
+     * @brief 请求结束时写入访问记录, 只填写定长记录, 格式化与写文件由后台线程完成
+    */
+    void log_access()
+    {
+        if ( impl_->access_log_ == nullptr || header_ == nullptr )
+        {
+            return;
+        }
+
+        auto rec = impl_->access_log_->claim();
+        if ( rec == nullptr )
+        {
+            return;
+        }
+
+        auto conn_impl = ( conn_ != nullptr ) ? HttpClientImpl::get( *conn_ ) : nullptr;
+        auto url     = STRING_CHECK( header_->url() ) ? header_->url() : "";
+        auto method  = STRING_CHECK( header_->method() ) ? header_->method() : "";
+        auto url_len = strlen( url );
+        rec->begin_ns   = req_begin_ns_;
+        rec->total_ns   = metric_now_ns() - req_begin_ns_;
+        rec->handler_ns = handler_ns_;
+        rec->bytes_in   = req_bytes_in_;
+        rec->bytes_out  = ( conn_impl != nullptr ) ? conn_impl->sent_bytes_ : 0;
+        rec->status     = ( status_ == 0 && conn_impl != nullptr ) ? conn_impl->resp_code_ : status_;
+        rec->url_bytes  = ( uint32_t )url_len;
+        memcpy( rec->url, url, std::min<size_t>( url_len, ACCESS_URL_BYTES ) );
+        strncpy( rec->method, method, ACCESS_METHOD_BYTES - 1 );
+        rec->method[ACCESS_METHOD_BYTES - 1] = 0;
+        strncpy( rec->peer, key_.c_str(), ACCESS_PEER_BYTES - 1 );
+        rec->peer[ACCESS_PEER_BYTES - 1] = 0;
+        impl_->access_log_->commit();
+    }
+
+    /**
+     * @brief 请求准入, 拒绝时发送预先生成的503并断开连接
+    */
+    bool admit()
+    {
+        if ( !impl_->admit_.enter( *route_inflight_, opt_.max_inflight ) )
+        {
+            WS_WARN_EVERY( WS_LOG_FLOOD_MS ) << "request shed url:" << header_->url();
+            count_status( eHttpRespCodeSvrUnavail );
+            auto const& resp = impl_->admit_.reject();
+            client_->send( ( char* )resp.c_str(), ( uint32_t )resp.length() );
+            return false;
+        }
+        admitted_ = true;
+        return true;
+    }
+
+    /**
+     * @brief 请求结束, 释放准入计数
+    */
+    void leave()
+    {
+        if ( admitted_ )
+        {
+            impl_->admit_.leave( *route_inflight_ );
+            admitted_ = false;
+        }
+    }
+
+    /**
+     * @brief 获取当前请求的回复连接, 同一请求的多次回调共用, 以保持回复的压缩状态
+    */
+    HttpClientSPtr const& conn()
+    {
+        if ( conn_ == nullptr )
+        {
+            auto enc = eHttpEncodingIdentity;
+            auto accept = header_->get<std::string>( "Accept-Encoding" );
+            if ( impl_->compress_ && accept.valid() )
+            {
+                enc = HttpDeflater::negotiate( accept.value() );
+            }
+            conn_ = HttpClientImpl::create( client_, impl_->compress_ ? &impl_->compress_opt_ : nullptr, enc, impl_->metrics_.get() );
+            HttpClientImpl::get( *conn_ )->conn_id_ = conn_id_;
+        }
+        return conn_;
+    }
+
+    bool call( DynPacketSPtr const& content )
+    {
+        return invoke( [&]()
+        {
+            return handler_( conn_, header_, content );
+        }, ( content != nullptr ) ? content->size() : 0 );
+    }
+
+    bool call_buffer( HttpBodyBuffer* body )
+    {
+        return invoke( [&]()
+        {
+            return buffer_handler_( conn_, header_, body );
+        }, ( body != nullptr ) ? body->size() : 0 );
+    }
+
+    /**
+     * @brief 调用处理函数, 路径设置offload时在线程池中执行, 协程等待期间让出调度线程
+     *        执行期间的回复暂存在内存中, 完成后在连接协程中发送
+    */
+    bool invoke( std::function<bool()> const& fn, uint64_t bytes )
+    {
+        WS_PROBE( handler_begin, eTraceHandlerBegin, conn_id_, bytes, 0 );
+        if ( route_metrics_ == nullptr && impl_->access_log_ == nullptr )
+        {
+            bool ret = run( fn );
+            WS_PROBE( handler_end, eTraceHandlerEnd, conn_id_, ret, 0 );
+            return ret;
+        }
+
+        uint64_t begin = metric_now_ns();
+        bool ret = run( fn );
+        WS_PROBE( handler_end, eTraceHandlerEnd, conn_id_, ret, 0 );
+        uint64_t cost = metric_now_ns() - begin;
+        handler_ns_ += cost;
+        if ( route_metrics_ != nullptr )
+        {
+            route_metrics_->handler_ns.record( cost );
+        }
+        return ret;
+    }
+
+    bool run( std::function<bool()> const& fn )
+    {
+        auto conn_impl = HttpClientImpl::get( *conn() );
+        if ( !opt_.offload || impl_->pool_ == nullptr )
+        {
+            return fn();
+        }
+
+        struct State
+        {
+            std::atomic<bool> done;
+            bool ret;
+            CoEvent event;
+        };
+        auto state = std::make_shared<State>();
+        state->done = false;
+        state->ret  = false;
+
+        conn_impl->begin_stage( &state->event );
+        impl_->pool_->submit( [state, &fn]()
+        {
+            state->ret  = fn();
+            state->done = true;
+            state->event.notify();
+        } );
+
+        // 处理函数在工作线程执行期间连接协程挂起, 不占用调度线程, 完成通知后恢复并发送暂存的回复
+        // 恢复延迟直接计入请求耗时, 等待间隔不退避, 暂存的回复达到上限时在等待期间发出
+        while ( 1 )
+        {
+            auto seen = state->event.generation();
+            if ( state->done )
+            {
+                break;
+            }
+
+            if ( conn_impl->stage_full() )
+            {
+                conn_impl->flush_stage(); // 失败时工作线程的写入随之失败, 仍需等待处理函数返回
+                continue;
+            }
+            state->event.wait( seen, 0, CO_EVENT_MIN_STEP );
+        }
+
+        if ( conn_impl->end_stage() != TARO_OK )
+        {
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "send staged response failed";
+            return false;
+        }
+        return state->ret;
+    }
+
+    /**
+     * @brief 解压请求数据体, 失败时回复错误
+     * 
+     * @param[in,out] content 数据体, 解压后暂无输出时为nullptr
+    */
+    bool decode( DynPacketSPtr& content )
+    {
+        if ( !inflating_ || content == nullptr )
+        {
+            return true;
+        }
+
+        DynPacketSPtr out;
+        auto ret = inflater_.feed( content->buffer(), content->size(), out );
+        if ( ret != TARO_OK )
+        {
+            error_response( ( ret == TARO_ERR_INVALID_ARG ) ? eHttpRespCodeTooLarge : eHttpRespCodeBadReq );
+            return false;
+        }
+        content = out;
+        return true;
+    }
+
+    /**
+     * @brief 累计数据体长度, 超过路径配置的上限时回复413
+    */
+    bool check_limit( int64_t bytes )
+    {
+        body_recv_ += ( uint64_t )std::max<int64_t>( bytes, 0 );
+        if ( opt_.max_body_bytes == 0 || body_recv_ <= opt_.max_body_bytes )
+        {
+            return true;
+        }
+
+        WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "request body too large:" << body_recv_ << " limit:" << opt_.max_body_bytes;
+        error_response( eHttpRespCodeTooLarge );
+        return false;
+    }
+
+    /**
+     * @brief 数据体接收前的检查, 通过后对Expect: 100-continue回复100
+    */
+    bool pre_check()
+    {
+        if ( opt_.pre_handler )
+        {
+            auto code = opt_.pre_handler( header_ );
+            if ( code != eHttpRespCodeOK )
+            {
+                WS_WARN_EVERY( WS_LOG_FLOOD_MS ) << "request rejected url:" << header_->url() << " code:" << code;
+                error_response( code );
+                return false; // 数据体未读取, 直接断开
+            }
+        }
+
+        auto expect = header_->get<std::string>( "Expect" );
+        if ( !expect.valid() )
+        {
+            return true;
+        }
+
+        if ( !str_equal( string_trim( expect.value() ), HTTP_EXPECT_CONTINUE ) )
+        {
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "expectation not supported:" << expect.value();
+            error_response( eHttpRespCodeExpectFail );
+            return false;
+        }
+
+        // 没有数据体或数据体已开始到达时不必回复100
+        bool no_body = ( HttpProtoPaser::TYPE_NORMAL == parser_.type() && parser_.body_bytes() == 0 );
+        if ( !no_body && parser_.rest_bytes() == 0 )
+        {
+            count_status( eHttpRespCodeContinue );
+            client_->send( ( char* )HTTP_CONTINUE_RESP, strlen( HTTP_CONTINUE_RESP ) );
+        }
+        return true;
+    }
+
+    /**
+     * @brief 交付一段数据体, 需要时先解压
+     * 
+     * @param[in] content 数据 nullptr 表示最后一包
+    */
+    bool on_slice( DynPacketSPtr content )
+    {
+        if ( inflating_ )
+        {
+            if ( content != nullptr )
+            {
+                if ( !decode( content ) )
+                    return false;
+                if ( content == nullptr )
+                    return true; // 暂无解压输出
+            }
+            else if ( !inflater_.finished() )
+            {
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "compressed body truncated";
+                error_response( eHttpRespCodeBadReq );
+                return false;
+            }
+        }
+
+        if ( buffer_handler_ )
+        {
+            if ( content != nullptr )
+                return append_body( content );
+            if ( !deliver_body() || !call_buffer( nullptr ) )
+                return false;
+        }
+        else if( !call( content ) )
+        {
+            return false;
+        }
+
+        if( content == nullptr )
+        {
+            clear();
+        }
+        return true;
+    }
+
+    /**
+     * @brief 按路径配置创建数据体缓存
+    */
+    void new_body()
+    {
+        body_.reset( new HttpBodyBuffer( opt_.spill_bytes, opt_.spill_dir.empty() ? nullptr : opt_.spill_dir.c_str() ) );
+    }
+
+    /**
+     * @brief 数据体写入缓存
+    */
+    bool append_body( DynPacketSPtr const& content )
+    {
+        if ( body_ == nullptr )
+        {
+            new_body();
+        }
+
+        if ( body_->append( content->buffer(), content->size() ) != TARO_OK )
+        {
+            error_response( eHttpRespCodeInterSvr );
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 缓存的数据体或part交给处理函数, 空数据体也交付
+    */
+    bool deliver_body()
+    {
+        if ( body_ == nullptr )
+        {
+            new_body();
+        }
+
+        if ( body_->flush() != TARO_OK )
+        {
+            error_response( eHttpRespCodeInterSvr );
+            return false;
+        }
+
+        bool ret = call_buffer( body_.get() );
+        body_.reset();
+        return ret;
+    }
+
+    /**
+     * @brief boundary数据体按part缓存后交付, 不在内存中保留整个part
+    */
+    bool on_boundary_buffer()
+    {
+        while( 1 )
+        {
+            DynPacketSPtr content;
+            bool part_end = false;
+            if ( TARO_ERR_CONTINUE == parser_.get_boundary_slice( content, part_end ) )
+            {
+                return true;
+            }
+
+            if ( content != nullptr && ( !check_limit( content->size() ) || !append_body( content ) ) )
+            {
+                return false;
+            }
+
+            if ( part_end )
+            {
+                if ( !deliver_body() )
+                    return false;
+                continue;
+            }
+
+            if ( content == nullptr )
+            {
+                if( !call_buffer( nullptr ) )
+                    return false;
+                clear();
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief Content-Length数据体按段交付, 内存中最多缓存一段
+    */
+    bool on_content_slice()
+    {
+        while( 1 )
+        {
+            DynPacketSPtr content;
+            if ( TARO_ERR_CONTINUE == parser_.get_content_slice( content, opt_.slice_bytes ) )
+            {
+                return true;
+            }
+
+            bool last = ( content == nullptr );
+            if ( !on_slice( content ) )
+            {
+                return false;
+            }
+
+            if ( last )
+            {
+                return true;
+            }
+        }
     }
 
     /**
@@ -167,7 +706,7 @@ PRIVATE: // 私有函数
         auto it = impl_->matched_routine_.find( header_->url() );
         if ( it != impl_->matched_routine_.end() )
         {
-            handler_ = it->second;
+            use_routine( it->second );
             return true;
         }
 
@@ -182,6 +721,10 @@ PRIVATE: // 私有函数
 
         if( shooted.empty() )
         {
+            if ( impl_->metrics_ != nullptr )
+            {
+                impl_->metrics_->add( HttpMetrics::eUnmatched );
+            }
             return false;
         }
 
@@ -203,10 +746,36 @@ PRIVATE: // 私有函数
             return false;
         } );
 
-        handler_ = impl_->wildcard_routine_[shooted.front()];
+        use_routine( impl_->wildcard_routine_[shooted.front()] );
         return true;
     }
 
+    void use_routine( HttpRoutine const& routine )
+    {
+        handler_        = routine.handler;
+        buffer_handler_ = routine.buffer_handler;
+        opt_            = routine.opt;
+        route_inflight_ = routine.inflight.get();
+        route_metrics_  = routine.metrics.get();
+        ++requests_;
+        if ( route_metrics_ != nullptr )
+        {
+            route_metrics_->requests.add( 0 );
+        }
+    }
+
+    /**
+     * @brief 记录不经过HttpClient发送的回复的状态码
+    */
+    void count_status( int32_t code )
+    {
+        status_ = code;
+        if ( impl_->metrics_ != nullptr )
+        {
+            impl_->metrics_->add_status( code );
+        }
+    }
+
     void notfound_repsonse()
     {
         HttpResponse resp( eHttpRespCodeNotFound );
@@ -217,10 +786,26 @@ PRIVATE: // 私有函数
         resp.set_time();
         resp.set_close();
         auto str = HttpResponseImpl::serialize( resp );
+        count_status( eHttpRespCodeNotFound );
         client_->send( ( char* )str.c_str(), str.length() );
         client_->send( ( char* )not_found, strlen( not_found ) );
     }
 
+    /**
+     * @brief 回复错误并关闭连接
+    */
+    void error_response( int32_t code )
+    {
+        HttpResponse resp = HttpRespState::contains( code ) ? HttpResponse( code ) : HttpResponse( code, "Rejected" );
+        resp.set( "Server",         "Taro Http Server 0.1" );
+        resp.set( "Content-Length", 0 );
+        resp.set_time();
+        resp.set_close();
+        auto str = HttpResponseImpl::serialize( resp );
+        count_status( code );
+        client_->send( ( char* )str.c_str(), str.length() );
+    }
+
     bool on_chunk_msg()
     {
         while( 1 )
@@ -229,20 +814,21 @@ PRIVATE: // 私有函数
             auto ret = parser_.get_chunk( content );
             if( ret == TARO_ERR_INVALID_ARG )
             {
-                WS_ERROR << "get chunk size failed, format error";
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "get chunk size failed, format error";
                 return false;
             }
 
             if( ret == TARO_OK )
             {
-                if( !handler_( HttpClientImpl::create( client_ ), header_, content ) )
+                bool last = ( content == nullptr );
+                if ( !last && !check_limit( content->size() ) )
                     return false;
 
-                if( content == nullptr )
-                {
-                    clear();
+                if ( !on_slice( content ) )
+                    return false;
+
+                if( last )
                     break;
-                }
             }
             else
             {
@@ -260,13 +846,16 @@ PRIVATE: // 私有函数
             auto ret = parser_.get_boundary( content );
             if( ret == TARO_ERR_INVALID_ARG )
             {
-                WS_ERROR << "get boundary failed, format error";
+                WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) << "get boundary failed, format error";
                 return false;
             }
 
             if( ret == TARO_OK )
             {
-                if( !handler_( HttpClientImpl::create( client_ ), header_, content ) )
+                if( content != nullptr && !check_limit( content->size() ) )
+                    return false;
+
+                if( !call( content ) )
                     return false;
 
                 if( content == nullptr )
@@ -288,51 +877,184 @@ PRIVATE: // 私有函数
         auto key = header_->get<std::string>( "sec-websocket-key" );
         if ( !key.valid() )
         {
-            WS_ERROR <<  "websocket key not found.";
+            WS_ERROR_EVERY( WS_LOG_FLOOD_MS ) <<  "websocket key not found.";
             return false;
         }
 
+        ws_session_ = std::make_shared<WsSession>( client_, false );
+        ws_session_->conn_id_ = conn_id_;
         if ( impl_->ws_handler_ )
         {
             WsRecvData result;
             result.evt = eWsEventOpen;
-            impl_->ws_handler_( WsClientImpl::create( client_ ), result );
+            impl_->ws_handler_( WsClientImpl::create( ws_session_ ), result );
             msg_handler_ = std::bind( &MsgHandler::on_ws_recv, this );
         }
         
-        HttpResponse resp( 101, "Switching protocols" );
-        resp.set( "Server",               "taro/1.1" );
-        resp.set( "Upgrade",              "websocket" );
-        resp.set( "Connection",           "upgrade" );
-        resp.set( "Sec-WebSocket-Accept", WsProto::create_key( key ) );
-        auto str = HttpResponseImpl::serialize( resp );
-        client_->send( ( char* )str.c_str(), str.length() );
+        std::string const& key_str = key.value();
+        char resp[WS_ACCEPT_RESP_BYTES];
+        auto resp_len = WsProto::create_accept_response( key_str.c_str(), ( uint32_t )key_str.length(), resp );
+        count_status( 101 );
+        client_->send( resp, resp_len );
+
+        if ( impl_->ws_handler_ && impl_->hb_interval_ > 0 )
+        {
+            ws_session_->hb_interval_   = impl_->hb_interval_;
+            ws_session_->hb_max_missed_ = impl_->hb_max_missed_;
+            WsHeartbeat::instance().add( ws_session_ );
+        }
         return true;
     }
 
 PRIVATE: // 私有变量
 
     HttpProtoPaser parser_;
+    bool inflating_;            // 当前请求的数据体正在解压
+    bool admitted_;             // 当前请求已通过准入, 结束时释放计数
+    bool ws_in_msg_;            // websocket分片消息接收中
+    bool ws_dropping_;          // 当前websocket消息因限速被丢弃
+    std::atomic<uint32_t>* route_inflight_; // 当前路径的请求计数
+    RouteMetrics* route_metrics_;           // 当前路径的指标 nullptr 表示不记录
+    int32_t status_;            // 直接发送的回复状态码 0 表示经由HttpClient回复
+    uint64_t req_begin_ns_;     // 当前请求的开始时间, 仅记录访问日志时设置
+    uint64_t handler_ns_;       // 当前请求处理函数的累计耗时
+    uint64_t req_bytes_in_;     // 当前请求接收的字节数
+    uint64_t conn_id_;          // 跟踪用的连接ID
+    uint64_t requests_;         // 连接上已匹配处理函数的请求数
+    uint64_t total_in_;         // 连接上接收的字节数
+    HttpInflater inflater_;
+    uint64_t body_recv_;        // 当前请求已接收的数据体长度
+    HttpRoutineOpt opt_;        // 当前请求的路径配置
+    std::unique_ptr<HttpBodyBuffer> body_; // 正在缓存的数据体或part
     WebServerImpl* impl_;
     HttpRequestSPtr header_;
+    std::string key_;           // 连接的限速key
+    HttpClientSPtr conn_;
     net::TcpClientSPtr client_;
+    WsSessionSPtr ws_session_;
     std::function<bool()> msg_handler_;
     WebServer::HttpRoutineHandler handler_;
+    WebServer::HttpBufferHandler buffer_handler_;
 };
 
 /**
 * @brief 服务端连接处理协程函数
 */
-void client_handle( net::TcpClientSPtr const& client, WebServerImpl* impl )
+void client_handle( net::TcpClientSPtr const& client, WebServerImpl* impl, std::string const& key, uint64_t conn_id )
 {
-    MsgHandler handler( client, impl );
-    while( 1 )
     {
-        if ( !handler.recv_msg() )
+        MsgHandler handler( client, impl, key, conn_id );
+        while( 1 )
         {
-            break;
+            if ( !handler.recv_msg() )
+            {
+                break;
+            }
         }
     }
+    impl->admit_.leave_conn();
+}
+
+/**
+ * @brief 转义Prometheus标签值
+*/
+std::string metric_label( std::string const& value )
+{
+    std::string out;
+    for ( auto c : value )
+    {
+        if ( c == '\\' || c == '"' )
+        {
+            out.push_back( '\\' );
+        }
+        out.push_back( c == '\n' ? ' ' : c );
+    }
+    return out;
+}
+
+/**
+ * @brief 以Prometheus文本格式输出指标, 队列深度等瞬时值在读取时采集
+*/
+std::string render_metrics( WebServerImpl* impl )
+{
+    auto metrics = impl->metrics_.get();
+    if ( metrics == nullptr )
+    {
+        return std::string();
+    }
+
+    std::stringstream ss;
+    ss.precision( 12 );
+    ss << "# TYPE co_ws_accepts_total counter\n"
+       << "co_ws_accepts_total " << metrics->counters.value( HttpMetrics::eAccepts ) << "\n"
+       << "# TYPE co_ws_connections gauge\n"
+       << "co_ws_connections " << impl->admit_.conns() << "\n"
+       << "# TYPE co_ws_inflight_requests gauge\n"
+       << "co_ws_inflight_requests " << impl->admit_.inflight() << "\n"
+       << "# TYPE co_ws_shed_total counter\n"
+       << "co_ws_shed_total " << impl->admit_.shed() << "\n"
+       << "# TYPE co_ws_received_bytes_total counter\n"
+       << "co_ws_received_bytes_total " << metrics->counters.value( HttpMetrics::eBytesIn ) << "\n"
+       << "# TYPE co_ws_sent_bytes_total counter\n"
+       << "co_ws_sent_bytes_total " << metrics->counters.value( HttpMetrics::eBytesOut ) << "\n"
+       << "# TYPE co_ws_unmatched_requests_total counter\n"
+       << "co_ws_unmatched_requests_total " << metrics->counters.value( HttpMetrics::eUnmatched ) << "\n"
+       << "# TYPE co_ws_websocket_frames_received_total counter\n"
+       << "co_ws_websocket_frames_received_total " << metrics->counters.value( HttpMetrics::eWsFramesIn ) << "\n";
+
+    if ( impl->access_log_ != nullptr )
+    {
+        ss << "# TYPE co_ws_access_log_dropped_total counter\n"
+           << "co_ws_access_log_dropped_total " << impl->access_log_->dropped() << "\n";
+    }
+
+    if ( impl->pool_ != nullptr )
+    {
+        ss << "# TYPE co_ws_offload_queue_depth gauge\n"
+           << "co_ws_offload_queue_depth " << impl->pool_->depth() << "\n"
+           << "# TYPE co_ws_offload_executed_total counter\n"
+           << "co_ws_offload_executed_total " << impl->pool_->executed() << "\n"
+           << "# TYPE co_ws_offload_wait_seconds_total counter\n"
+           << "co_ws_offload_wait_seconds_total " << ( double )impl->pool_->wait_us_total() / 1e6 << "\n";
+    }
+
+    ss << "# TYPE co_ws_responses_total counter\n";
+    for ( int32_t code = 0; code < METRIC_STATUS_MAX; ++code )
+    {
+        auto count = metrics->status.value( ( uint32_t )code );
+        if ( count > 0 )
+        {
+            ss << "co_ws_responses_total{code=\"" << code << "\"} " << count << "\n";
+        }
+    }
+
+    ss << "# TYPE co_ws_parse_seconds histogram\n";
+    metrics->parse_ns.render( ss, "co_ws_parse_seconds", std::string() );
+
+    std::vector<std::pair<std::string, RouteMetrics*>> routes;
+    for ( auto const* map : { &impl->matched_routine_, &impl->wildcard_routine_ } )
+    {
+        for ( auto const& one : *map )
+        {
+            if ( one.second.metrics != nullptr )
+            {
+                routes.emplace_back( "route=\"" + metric_label( one.first ) + "\"", one.second.metrics.get() );
+            }
+        }
+    }
+
+    ss << "# TYPE co_ws_requests_total counter\n";
+    for ( auto const& one : routes )
+    {
+        ss << "co_ws_requests_total{" << one.first << "} " << one.second->requests.value( 0 ) << "\n";
+    }
+
+    ss << "# TYPE co_ws_handler_seconds histogram\n";
+    for ( auto const& one : routes )
+    {
+        one.second->handler_ns.render( ss, "co_ws_handler_seconds", one.first );
+    }
+    return ss.str();
 }
 
 WebServer::WebServer()
@@ -378,28 +1100,88 @@ int32_t WebServer::start( uint16_t port, const char* ip, net::SSLContext* ssl_ct
     {
         while( 1 )
         {
-            auto client = impl_->svr_->accept();
-            co_run std::bind( client_handle, client, impl_ ), opt_name( "web_client" );
+            auto client  = impl_->svr_->accept();
+            auto conn_id = Tracer::next_conn_id();
+            WS_PROBE( accept, eTraceAccept, conn_id, 0, 0 );
+            if ( impl_->metrics_ != nullptr )
+            {
+                impl_->metrics_->add( HttpMetrics::eAccepts );
+            }
+
+            auto key = impl_->limiter_.conn_key( client );
+            if ( !impl_->limiter_.allow_conn( key ) )
+            {
+                if ( impl_->metrics_ != nullptr )
+                {
+                    impl_->metrics_->add_status( eHttpRespCodeTooMany );
+                }
+                auto const& resp = impl_->limiter_.reject();
+                client->send( ( char* )resp.c_str(), ( uint32_t )resp.length() );
+                client->close();
+                continue;
+            }
+
+            if ( !impl_->admit_.enter_conn() )
+            {
+                // 不创建协程, 直接回复503并关闭
+                if ( impl_->metrics_ != nullptr )
+                {
+                    impl_->metrics_->add_status( eHttpRespCodeSvrUnavail );
+                }
+                auto const& resp = impl_->admit_.reject();
+                client->send( ( char* )resp.c_str(), ( uint32_t )resp.length() );
+                client->close();
+                continue;
+            }
+            co_run std::bind( client_handle, client, impl_, key, conn_id ), opt_name( "web_client" );
         }
     }, opt_name( "webserver" );
+
+    if ( impl_->admit_.opt().target_delay_ms > 0 )
+    {
+        auto impl = impl_;
+        co_run [impl]()
+        {
+            while( 1 )
+            {
+                uint64_t begin = SystemTime::current_ms();
+                rt::co_wait( HTTP_ADMIT_PROBE_MS );
+                uint64_t now  = SystemTime::current_ms();
+                uint64_t cost = now - begin;
+                impl->admit_.on_delay( ( uint32_t )( cost > HTTP_ADMIT_PROBE_MS ? cost - HTTP_ADMIT_PROBE_MS : 0 ), now );
+            }
+        }, opt_name( "web_admission" );
+    }
     return TARO_OK;
 }
 
-int32_t WebServer::set_routine( const char* url, HttpRoutineHandler const& handler )
+int32_t WebServer::set_routine( const char* url, HttpRoutineHandler const& handler, HttpRoutineOpt const& opt )
 {
-    if ( !STRING_CHECK( url ) || !handler )
+    if ( !STRING_CHECK( url ) || !handler || ( opt.stream_body && opt.slice_bytes == 0 ) )
     {
         WS_ERROR << "parameter invalid";
         return TARO_ERR_INVALID_ARG;
     }
 
-    if( is_wildcard( url ) )
+    HttpRoutine routine;
+    routine.handler = handler;
+    routine.opt     = opt;
+    impl_->add_routine( url, routine );
+    return TARO_OK;
+}
+
+int32_t WebServer::set_buffered_routine( const char* url, HttpBufferHandler const& handler, HttpRoutineOpt const& opt )
+{
+    if ( !STRING_CHECK( url ) || !handler )
     {
-        impl_->wildcard_routine_[url] = handler;
-        return TARO_OK;
+        WS_ERROR << "parameter invalid";
+        return TARO_ERR_INVALID_ARG;
     }
 
-    impl_->matched_routine_[url] = handler;
+    HttpRoutine routine;
+    routine.buffer_handler = handler;
+    routine.opt            = opt;
+    impl_->add_routine( url, routine );
     return TARO_OK;
 }
 
@@ -412,8 +1194,9 @@ int32_t WebServer::set_path( const char* dir )
     }
 
     impl_->file_reader_.reset( new FileReader( dir ) );
-    impl_->wildcard_routine_["/*"] =
-        std::bind( &FileReader::on_message, impl_->file_reader_.get(), std::placeholders::_1, std::placeholders::_2, std::placeholders::_3 );
+    HttpRoutine routine;
+    routine.handler = std::bind( &FileReader::on_message, impl_->file_reader_.get(), std::placeholders::_1, std::placeholders::_2, std::placeholders::_3 );
+    impl_->add_routine( "/*", routine );
     return TARO_OK;
 }
 
@@ -428,4 +1211,205 @@ int32_t WebServer::set_ws_handler( WebsocketHandler const& handler )
     return TARO_OK;
 }
 
+void WebServer::set_decode( bool enable, uint64_t max_bytes )
+{
+    impl_->decode_       = enable;
+    impl_->decode_limit_ = max_bytes;
+}
+
+int32_t WebServer::set_compress( bool enable, HttpCompressOpt const& opt )
+{
+    if ( enable && ( opt.level < 1 || opt.level > 9 ) )
+    {
+        WS_ERROR << "compress level invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+    impl_->compress_     = enable;
+    impl_->compress_opt_ = opt;
+    return TARO_OK;
+}
+
+int32_t WebServer::set_rate_limit( HttpRateOpt const& opt, HttpConnKeyFunc const& conn_key, HttpReqKeyFunc const& req_key )
+{
+    if ( nullptr != impl_->svr_ )
+    {
+        WS_ERROR << "server already started";
+        return TARO_ERR_MULTI_OP;
+    }
+
+    if ( opt.capacity == 0 || opt.conn_rate < 0 || opt.req_rate < 0 || opt.ws_rate < 0 )
+    {
+        WS_ERROR << "parameter invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+
+    if ( !conn_key && ( opt.conn_rate > 0 || opt.ws_rate > 0 || ( opt.req_rate > 0 && !req_key ) ) )
+    {
+        WS_ERROR << "key function not set";
+        return TARO_ERR_INVALID_ARG;
+    }
+    impl_->limiter_.set( opt, conn_key, req_key );
+    return TARO_OK;
+}
+
+int32_t WebServer::set_admission( HttpAdmitOpt const& opt )
+{
+    if ( nullptr != impl_->svr_ )
+    {
+        WS_ERROR << "server already started";
+        return TARO_ERR_MULTI_OP;
+    }
+
+    if ( opt.target_delay_ms > 0 && opt.interval_ms == 0 )
+    {
+        WS_ERROR << "parameter invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+    impl_->admit_.set( opt );
+    return TARO_OK;
+}
+
+int32_t WebServer::set_offload( uint32_t threads )
+{
+    if ( nullptr != impl_->svr_ )
+    {
+        WS_ERROR << "server already started";
+        return TARO_ERR_MULTI_OP;
+    }
+
+    if ( threads == 0 )
+    {
+        threads = std::max<uint32_t>( std::thread::hardware_concurrency(), 1 );
+    }
+    impl_->pool_.reset( new WorkPool( threads ) );
+    return TARO_OK;
+}
+
+int32_t WebServer::set_access_log( HttpAccessLogOpt const& opt )
+{
+    if ( nullptr != impl_->svr_ )
+    {
+        WS_ERROR << "server already started";
+        return TARO_ERR_MULTI_OP;
+    }
+
+    if ( opt.path.empty() || opt.ring_records == 0 || opt.flush_ms == 0 )
+    {
+        WS_ERROR << "parameter invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+
+    std::unique_ptr<AccessLog> log( new AccessLog( opt ) );
+    if ( !log->start() )
+    {
+        return TARO_ERR_FAILED;
+    }
+    impl_->access_log_ = std::move( log );
+    return TARO_OK;
+}
+
+int32_t WebServer::set_metrics( const char* url )
+{
+    if ( nullptr != impl_->svr_ )
+    {
+        WS_ERROR << "server already started";
+        return TARO_ERR_MULTI_OP;
+    }
+
+    if ( impl_->metrics_ == nullptr )
+    {
+        impl_->metrics_.reset( new HttpMetrics );
+        for ( auto* map : { &impl_->matched_routine_, &impl_->wildcard_routine_ } )
+        {
+            for ( auto& one : *map )
+            {
+                one.second.metrics = std::make_shared<RouteMetrics>();
+            }
+        }
+    }
+
+    if ( !STRING_CHECK( url ) )
+    {
+        return TARO_OK;
+    }
+
+    auto impl = impl_;
+    return set_routine( url, [impl]( HttpClientSPtr conn, HttpRequestSPtr const&, DynPacketSPtr const& )
+    {
+        auto text = render_metrics( impl );
+        HttpResponse resp;
+        resp.set( "Server",         "Taro Http Server 0.1" );
+        resp.set( "Content-Type",   "text/plain; version=0.0.4" );
+        resp.set( "Content-Length", text.length() );
+        resp.set_time();
+        conn->send_resp( resp );
+        conn->send_body( string_packet( text.c_str() ) );
+        return true;
+    } );
+}
+
+std::string WebServer::metrics() const
+{
+    return render_metrics( impl_ );
+}
+
+int32_t WebServer::set_trace( uint32_t events, const char* url )
+{
+    if ( STRING_CHECK( url ) && nullptr != impl_->svr_ )
+    {
+        WS_ERROR << "server already started";
+        return TARO_ERR_MULTI_OP;
+    }
+
+    Tracer::instance().set( events );
+    if ( !STRING_CHECK( url ) )
+    {
+        return TARO_OK;
+    }
+
+    return set_routine( url, []( HttpClientSPtr conn, HttpRequestSPtr const&, DynPacketSPtr const& )
+    {
+        auto text = Tracer::instance().dump();
+        HttpResponse resp;
+        resp.set( "Server",         "Taro Http Server 0.1" );
+        resp.set( "Content-Type",   "text/plain" );
+        resp.set( "Content-Length", text.length() );
+        resp.set_time();
+        conn->send_resp( resp );
+        conn->send_body( string_packet( text.c_str() ) );
+        return true;
+    } );
+}
+
+std::string WebServer::trace_dump() const
+{
+    return Tracer::instance().dump();
+}
+
+HttpOffloadStats WebServer::offload_stats() const
+{
+    HttpOffloadStats stats;
+    if ( impl_->pool_ != nullptr )
+    {
+        stats.threads       = impl_->pool_->threads();
+        stats.queue_depth   = impl_->pool_->depth();
+        stats.executed      = impl_->pool_->executed();
+        stats.wait_us_total = impl_->pool_->wait_us_total();
+        stats.wait_us_max   = impl_->pool_->wait_us_max();
+    }
+    return stats;
+}
+
+int32_t WebServer::set_ws_heartbeat( uint32_t interval_ms, uint32_t max_missed )
+{
+    if ( interval_ms > 0 && max_missed == 0 )
+    {
+        WS_ERROR << "parameter invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+    impl_->hb_interval_   = interval_ms;
+    impl_->hb_max_missed_ = max_missed;
+    return TARO_OK;
+}
+
 NAMESPACE_TARO_WS_END
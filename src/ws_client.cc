@@ -2,6 +2,7 @@
 #include "impl/ws_proto.h"
 #include "impl/ws_client_impl.h"
 #include "impl/http_client_impl.h"
+#include "impl/file_io.h"
 
 #if defined( _WIN32 ) || defined( _WIN64 )
 #pragma comment(lib, "ws2_32.lib")
@@ -20,7 +21,7 @@ WsClient::~WsClient()
     delete impl_;
 }
 
-int32_t WsClient::open( const char* ip, uint16_t port, const char* url, net::SSLContext* ctx )
+int32_t WsClient::open( const char* ip, uint16_t port, const char* url, net::SSLContext* ctx, uint32_t ms )
 {
     if ( !impl_->active_ )
     {
@@ -28,7 +29,7 @@ int32_t WsClient::open( const char* ip, uint16_t port, const char* url, net::SSL
         return TARO_ERR_NOT_SUPPORT;
     }
 
-    if ( impl_->client_ != nullptr )
+    if ( impl_->session_ != nullptr )
     {
         WS_ERROR << "already connected";
         return TARO_ERR_MULTI_OP;
@@ -42,10 +43,12 @@ int32_t WsClient::open( const char* ip, uint16_t port, const char* url, net::SSL
 
     auto tcp_cli = net::create_tcp_cli( ctx );
     TARO_ASSERT( tcp_cli != nullptr, "create tcp client failed" );
-    if( !tcp_cli->connect( ip, port ) )
+    Deadline dl( ms );
+    auto ret = connect_until( tcp_cli, ip, port, dl );
+    if( ret != TARO_OK )
     {
         WS_ERROR << "connect to " << ip  << ":" << port << "failed";
-        return TARO_ERR_FAILED;
+        return ret;
     }
     
     // 发送open请求，并对回复进行校验
@@ -53,7 +56,13 @@ int32_t WsClient::open( const char* ip, uint16_t port, const char* url, net::SSL
     ss << ip << ":" << port;
     auto req = WsProto::create_open_packet( ss.str(), url, impl_->check_str_ );
     auto http_client = HttpClientImpl::create( tcp_cli );
-    auto result = http_client->request( req );
+    auto result = http_client->request( req, dl.remain() );
+    if ( result.ret == TARO_ERR_TIMEOUT )
+    {
+        WS_ERROR << "websocket handshake timeout";
+        return TARO_ERR_TIMEOUT;
+    }
+
     if ( result.ret != TARO_OK || result.resp == nullptr || result.resp->code() != 101 )
     {
         WS_ERROR << "server response invalid. ret:" << result.ret;
@@ -71,33 +80,138 @@ int32_t WsClient::open( const char* ip, uint16_t port, const char* url, net::SSL
         WS_ERROR << "key check failed";
         return TARO_ERR_FAILED;
     }
-    impl_->client_ = tcp_cli;
+    impl_->session_ = std::make_shared<WsSession>( tcp_cli, true );
+    if ( impl_->hb_interval_ > 0 )
+    {
+        impl_->session_->hb_interval_   = impl_->hb_interval_;
+        impl_->session_->hb_max_missed_ = impl_->hb_max_missed_;
+        WsHeartbeat::instance().add( impl_->session_ );
+    }
     return TARO_OK;
 }
 
-bool WsClient::send( char* buffer, int32_t bytes, EWsDataKind const& kind, bool use_mask )
+bool WsClient::send( char* buffer, uint64_t bytes, EWsDataKind const& kind, bool use_mask )
 {
+    if ( nullptr == buffer && bytes > 0 )
+    {
+        WS_ERROR << "parameter invalid";
+        return false;
+    }
+
     auto opcode = ( ( kind == eWsDataKindText ) ? WS_OP_CONTENT_TEXT : WS_OP_CONTENT_BINARY );
-    auto packets = WsProto::split_packet( ( uint8_t* )buffer, bytes, opcode, use_mask );
-    for ( auto const& one : packets )
+    return WsClientImpl::send_buffer( *impl_->session_, ( uint8_t* )buffer, bytes, opcode, use_mask, false );
+}
+
+bool WsClient::send_urgent( char* buffer, uint64_t bytes, EWsDataKind const& kind, bool use_mask )
+{
+    if ( nullptr == buffer && bytes > 0 )
     {
-        if ( impl_->client_->send( ( char* )one->buffer(), one->size() ) < 0 )
+        WS_ERROR << "parameter invalid";
+        return false;
+    }
+
+    auto opcode = ( ( kind == eWsDataKindText ) ? WS_OP_CONTENT_TEXT : WS_OP_CONTENT_BINARY );
+    return WsClientImpl::send_buffer( *impl_->session_, ( uint8_t* )buffer, bytes, opcode, use_mask, true );
+}
+
+bool WsClient::send_stream( WsPullFunc const& pull, EWsDataKind const& kind, bool use_mask )
+{
+    if ( !pull )
+    {
+        WS_ERROR << "parameter invalid";
+        return false;
+    }
+
+    auto opcode = ( ( kind == eWsDataKindText ) ? WS_OP_CONTENT_TEXT : WS_OP_CONTENT_BINARY );
+    return WsClientImpl::send_stream( *impl_->session_, pull, opcode, use_mask );
+}
+
+bool WsClient::send_file( int32_t fd, uint64_t offset, uint64_t bytes, EWsDataKind const& kind, bool use_mask )
+{
+    if ( fd < 0 )
+    {
+        WS_ERROR << "fd invalid";
+        return false;
+    }
+
+    uint64_t sent = 0;
+    return send_stream( [&]( uint8_t* buf, uint32_t size ) -> int64_t
+    {
+        auto len = ( uint32_t )std::min<uint64_t>( size, bytes - sent );
+        if ( len == 0 )
         {
-            return false;
+            return 0;
         }
-    }
-    return true;
+
+        auto ret = read_at( fd, buf, len, offset + sent );
+        if ( ret <= 0 )
+        {
+            WS_ERROR << "read file failed, offset:" << offset + sent;
+            return TARO_ERR_FAILED; // 文件长度不足也视为失败
+        }
+        sent += ( uint64_t )ret;
+        return ret;
+    }, kind, use_mask );
 }
 
-WsRecvData WsClient::recv()
+WsRecvData WsClient::recv( uint32_t ms )
 {
     WsRecvData result;
-    result.ret = WsClientImpl::recv_ws( impl_->client_, result.body, result.last_pack, result.kind, result.evt );
+    result.ret = WsClientImpl::recv_ws( *impl_->session_, result.body, result.last_pack, result.kind, result.evt, Deadline( ms ) );
+    if ( result.ret == TARO_ERR_TIMEOUT && !impl_->session_->dead_ )
+    {
+        return result; // 帧之间超时, 连接仍可用
+    }
+
     if( result.ret < 0 )
     {
+        if ( impl_->session_->dead_ )
+        {
+            result.evt = eWsEventTimeout;
+        }
         WS_ERROR << "receive websocket failed";
     }
     return result;
 }
 
+int32_t WsClient::set_heartbeat( uint32_t interval_ms, uint32_t max_missed )
+{
+    if ( !impl_->active_ )
+    {
+        WS_ERROR << "not support this method";
+        return TARO_ERR_NOT_SUPPORT;
+    }
+
+    if ( interval_ms > 0 && max_missed == 0 )
+    {
+        WS_ERROR << "parameter invalid";
+        return TARO_ERR_INVALID_ARG;
+    }
+
+    if ( impl_->hb_interval_ > 0 && impl_->session_ != nullptr )
+    {
+        WS_ERROR << "heartbeat already started";
+        return TARO_ERR_MULTI_OP;
+    }
+
+    impl_->hb_interval_   = interval_ms;
+    impl_->hb_max_missed_ = max_missed;
+    if ( interval_ms > 0 && impl_->session_ != nullptr )
+    {
+        impl_->session_->hb_interval_   = interval_ms;
+        impl_->session_->hb_max_missed_ = max_missed;
+        WsHeartbeat::instance().add( impl_->session_ );
+    }
+    return TARO_OK;
+}
+
+int32_t WsClient::rtt() const
+{
+    if ( impl_->session_ == nullptr )
+    {
+        return -1;
+    }
+    return impl_->session_->rtt_ms_;
+}
+
 NAMESPACE_TARO_WS_END
@@ -1,8 +1,13 @@
 ﻿
 #include "web_server.h"
+#include "http_client_pool.h"
+#include "impl/ws_proto.h"
 #include <co_routine/inc.h>
 #include <net/net_work.h>
 #include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 USING_NAMESPACE_TARO
 USING_NAMESPACE_TARO_WS
@@ -62,6 +67,55 @@ void web_svr_test()
         return true;
     } );
 
+    // Content-Length数据体按段接收, 超过上限回复413
+    HttpRoutineOpt upload_opt;
+    upload_opt.stream_body    = true;
+    upload_opt.slice_bytes    = 0x10000;
+    upload_opt.max_body_bytes = 1ULL << 30;
+    upload_opt.pre_handler    = []( HttpRequestSPtr const& req )
+    {
+        return req->contains( "Authorization" ) ? eHttpRespCodeOK : eHttpRespCodeUnauth; // 未鉴权的上传在数据体发送前拒绝
+    };
+    svr.set_routine( "/upload", []( HttpClientSPtr client, HttpRequestSPtr const&, DynPacketSPtr const& body )
+    {
+        static uint64_t total = 0;
+        if( body != nullptr )
+        {
+            total += body->size();
+        }
+        else
+        {
+            std::cout << "upload finish bytes:" << total << std::endl;
+            total = 0;
+            response( client );
+        }
+        return true;
+    }, upload_opt );
+
+    // 数据体缓存后处理, 超过1MB转存到临时文件, boundary请求每个part回调一次
+    svr.set_buffered_routine( "/upload_buffered", []( HttpClientSPtr client, HttpRequestSPtr const&, HttpBodyBuffer* body )
+    {
+        if( body != nullptr )
+        {
+            std::cout << "body bytes:" << body->size() << " spilled:" << body->spilled() << std::endl;
+        }
+        else
+        {
+            response( client );
+        }
+        return true;
+    } );
+
+    // 耗时的处理函数在工作线程池中执行, 不阻塞其他连接
+    HttpRoutineOpt heavy_opt;
+    heavy_opt.offload = true;
+    svr.set_routine( "/heavy", []( HttpClientSPtr client, HttpRequestSPtr const&, DynPacketSPtr const& )
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+        response( client );
+        return true;
+    }, heavy_opt );
+
     // 客户端请求服务端推送chunk
     svr.set_routine( "/get_chunk", []( HttpClientSPtr client, HttpRequestSPtr const& req, DynPacketSPtr const& )
     {
@@ -173,8 +227,15 @@ void web_svr_test()
         {
             std::cout << "websocket closed" << std::endl;
         }
+        else if( data.evt == eWsEventTimeout )
+        {
+            std::cout << "websocket heartbeat timeout" << std::endl;
+        }
         return true;
     } );
+    svr.set_ws_heartbeat( 5000 ); // 每5秒发送一次ping, 连续3次无pong则断开
+    svr.set_metrics(); // 指标输出到 /metrics
+    svr.set_trace( 4096, "/trace" ); // 最近的跟踪事件输出到 /trace
 
     svr.start( 20002 );
     rt::co_loop();
@@ -428,11 +489,41 @@ void http_client_get_boundary()
     rt::co_loop();
 }
 
+void http_pool_test()
+{
+    co_run []()
+    {
+        HttpPoolOpt opt;
+        opt.max_per_host = 2;
+        HttpClientPool pool( opt );
+        while( 1 )
+        {
+            auto client = pool.acquire( "127.0.0.1", 20002 );
+            if( client == nullptr )
+            {
+                rt::co_wait( 1000 );
+                continue;
+            }
+
+            HttpRequest req( "GET", "/index.html" );
+            req.set( "User-Agent", "Taro Client" );
+            req.set( "Accept-Encoding", "identity" );
+            auto result = client->request( req );
+            printf( "pool request ret:%d idle connections:%u\n", result.ret, pool.idle_count() );
+            pool.release( client ); // 回复已读完的连接放回连接池复用
+            pool.evict();
+            rt::co_wait( 1000 );
+        }
+    };
+    rt::co_loop();
+}
+
 void ws_client_test()
 {
     co_run[]()
     {
         auto client = std::make_shared<WsClient>();
+        client->set_heartbeat( 5000 );
         while( client->open( "127.0.0.1", 20002 ) != TARO_OK )
         {
             rt::co_wait( 1000 );
@@ -462,13 +553,65 @@ void ws_client_test()
                 break;
             }
 
-            std::cout << "ws client receive:" << std::string( ( char* )result.body->buffer(), result.body->size() ) << std::endl;
+            std::cout << "ws client receive:" << std::string( ( char* )result.body->buffer(), result.body->size() )
+                      << " rtt:" << client->rtt() << "ms" << std::endl;
             rt::co_wait( 1000 );
         }
     };
     rt::co_loop();
 }
 
+void ws_handshake_bench()
+{
+    // 单线程计算握手回复, 结果即为单核每秒可完成的握手数
+    const uint32_t count = 1000000;
+    const char* key = "dGhlIHNhbXBsZSBub25jZQ==";
+    char resp[WS_ACCEPT_RESP_BYTES];
+    uint64_t check = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        check += WsProto::create_accept_response( key, ( uint32_t )strlen( key ), resp );
+        check += ( uint8_t )resp[WS_ACCEPT_RESP_BYTES - 5];
+    }
+    auto cost = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - begin ).count();
+    printf( "handshake: %u in %lld us, %.0f handshakes/s per core (check %llu)\n",
+            count, ( long long )cost, count * 1000000.0 / ( cost > 0 ? cost : 1 ), ( unsigned long long )check );
+}
+
+void ws_mask_bench()
+{
+    // 多线程并发生成带掩码的数据帧, 观察吞吐随线程数的变化
+    const uint32_t frames = 200000;
+    const uint32_t frame_bytes = 1024;
+    uint32_t max_threads = std::max<uint32_t>( 1, std::thread::hardware_concurrency() );
+    for( uint32_t threads = 1; threads <= max_threads; threads *= 2 )
+    {
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for( uint32_t t = 0; t < threads; ++t )
+        {
+            workers.emplace_back( [&]()
+            {
+                std::vector<uint8_t> payload( frame_bytes, 'a' );
+                for( uint32_t i = 0; i < frames; ++i )
+                {
+                    WsProto::create_single_packet( payload.data(), frame_bytes, WS_OP_CONTENT_BINARY, true, true );
+                }
+            } );
+        }
+        for( auto& one : workers )
+        {
+            one.join();
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - begin ).count();
+        double mbytes = ( double )threads * frames * frame_bytes / ( 1024 * 1024 );
+        printf( "masked frames: %u threads, %.0f MB/s, %.0f frames/s\n",
+                threads, mbytes * 1000000.0 / ( cost > 0 ? cost : 1 ), threads * frames * 1000000.0 / ( cost > 0 ? cost : 1 ) );
+    }
+}
+
 int main( int argc, char** argv )
 {
     if ( argc < 2 )
@@ -506,6 +649,15 @@ int main( int argc, char** argv )
     case 7:
         ws_client_test();
         break;
+    case 8:
+        ws_handshake_bench();
+        break;
+    case 9:
+        ws_mask_bench();
+        break;
+    case 10:
+        http_pool_test();
+        break;
     }
     net::stop_network();
     return 0;